@@ -0,0 +1,74 @@
+#pragma once
+
+// C-API of the LossyQueue extension module, for other extension modules
+// (C, Cython) that want to move PyObject* batches through a LossyQueue
+// without going through the Python-level put()/get() methods.
+//
+//     const LossyQueue_CAPI* lq_api = LossyQueue_ImportCAPI(LOSSYQUEUE_CAPI_NAME);
+//     struct SPMCQueue* q = lq_api->get_queue(obj);
+//
+//     Py_BEGIN_ALLOW_THREADS
+//     n = lq_api->push_many(q, items, count);   // steals pushed references
+//     Py_END_ALLOW_THREADS
+//
+// The debug build of the module exports the same table under
+// LOSSYQUEUE_DEBUG_CAPI_NAME. The struct SPMCQueue* stays valid for as long
+// as the caller holds a reference to the LossyQueue object. Include
+// SPMCQueue.h as well to call the queue functions on it directly.
+
+#include <Python.h>
+#include <stddef.h>
+
+struct SPMCQueue;
+
+#define LOSSYQUEUE_CAPI_NAME "LossyQueue._C_API"
+#define LOSSYQUEUE_DEBUG_CAPI_NAME "LossyQueue_debug._C_API"
+
+// Bumped on incompatible changes; new members are only ever appended and
+// show up as a larger struct_size.
+#define LOSSYQUEUE_CAPI_VERSION 1
+
+typedef struct {
+    unsigned int version;
+    size_t struct_size;
+    PyTypeObject* type;
+
+    // GIL required. Return the queue behind a LossyQueue instance, or NULL
+    // with TypeError (not a LossyQueue) or RuntimeError (__init__() has not
+    // run) set.
+    struct SPMCQueue* (*get_queue)(PyObject* lq);
+
+    // GIL not required. Non-lossy push: the references of the items that
+    // were pushed (the first n returned) now belong to the queue, the rest
+    // stay with the caller. Producer thread only, like put().
+    size_t (*push_many)(struct SPMCQueue* queue, PyObject** items,
+      size_t howmany);
+    // GIL not required. Pop up to howmany items; the caller owns the
+    // returned references and must Py_DECREF() them with the GIL held.
+    size_t (*pop_many)(struct SPMCQueue* queue, PyObject** items,
+      size_t howmany);
+
+    // GIL required. Lossy put of borrowed references, same semantics as
+    // LossyQueue.put_many(): the oldest items are dropped to make room, and
+    // a batch larger than the queue is rejected with ValueError. Returns 0,
+    // or -1 with an exception set.
+    int (*put_many)(PyObject* lq, PyObject* const* items, size_t howmany);
+} LossyQueue_CAPI;
+
+// Import the C-API table, returns NULL with an exception set on failure.
+static inline const LossyQueue_CAPI*
+LossyQueue_ImportCAPI(const char* capsule_name)
+{
+    const LossyQueue_CAPI* api = PyCapsule_Import(capsule_name, 0);
+
+    if (api == NULL) {
+        return NULL;
+    }
+    if (api->version != LOSSYQUEUE_CAPI_VERSION ||
+      api->struct_size < sizeof(LossyQueue_CAPI)) {
+        PyErr_Format(PyExc_ImportError, "%s: C-API version %u, expected %u",
+          capsule_name, api->version, LOSSYQUEUE_CAPI_VERSION);
+        return NULL;
+    }
+    return api;
+}
@@ -2,6 +2,7 @@
 
 #include <Python.h>
 #include "SPMCQueue.h"
+#include "LossyQueue_capi.h"
 
 #define MODULE_BASENAME LossyQueue
 
@@ -104,13 +105,38 @@ static PyObject* PyLossyQueue_put(PyLossyQueue* self, PyObject* args) {
     Py_RETURN_NONE;
 }
 
+// Push owned references, dropping the oldest items to make room
+static void
+lossy_push_many(PyLossyQueue* self, PyObject* const* items, size_t count)
+{
+    size_t offset = 0;
+
+    while (offset < count) {
+        size_t pushed = try_push_many(self->queue,
+          (void **)(items + offset), count - offset);
+
+        offset += pushed;
+        if (offset == count) {
+            break;
+        }
+
+        size_t needed = count - offset;
+        size_t to_pop = needed < self->queue_size ? needed : self->queue_size;
+        size_t popped;
+
+        popped = try_pop_many(self->queue, (void **)self->pop_buffer, to_pop);
+        for (size_t j = 0; j < popped; j++) {
+            Py_DECREF(self->pop_buffer[j]);
+        }
+    }
+}
+
 static PyObject*
 PyLossyQueue_put_many(PyLossyQueue* self, PyObject* items_obj)
 {
     PyObject* seq = PySequence_Fast(items_obj, "items must be iterable");
     Py_ssize_t count;
     Py_ssize_t i;
-    size_t offset = 0;
 
     if (seq == NULL) {
         return NULL;
@@ -136,25 +162,7 @@ PyLossyQueue_put_many(PyLossyQueue* self, PyObject* items_obj)
     }
     Py_DECREF(seq);
 
-    while (offset < (size_t)count) {
-        size_t pushed = try_push_many(self->queue,
-          (void **)(self->push_buffer + offset),
-          (size_t)count - offset);
-
-        offset += pushed;
-        if (offset == (size_t)count) {
-            break;
-        }
-
-        size_t needed = (size_t)count - offset;
-        size_t to_pop = needed;
-        size_t popped;
-
-        popped = try_pop_many(self->queue, (void **)self->pop_buffer, to_pop);
-        for (size_t j = 0; j < popped; j++) {
-            Py_DECREF(self->pop_buffer[j]);
-        }
-    }
+    lossy_push_many(self, self->push_buffer, (size_t)count);
     Py_RETURN_NONE;
 }
 
@@ -188,6 +196,61 @@ static PyTypeObject PyLossyQueueType = {
     .tp_methods = PyLossyQueue_methods,
 };
 
+static SPMCQueue*
+capi_get_queue(PyObject* lq)
+{
+    if (!PyObject_TypeCheck(lq, &PyLossyQueueType)) {
+        PyErr_Format(PyExc_TypeError, "expected " MODULE_NAME_STR ", got %s",
+          Py_TYPE(lq)->tp_name);
+        return NULL;
+    }
+    if (((PyLossyQueue*)lq)->queue == NULL) {
+        PyErr_SetString(PyExc_RuntimeError, "queue is not initialized");
+        return NULL;
+    }
+    return ((PyLossyQueue*)lq)->queue;
+}
+
+static size_t
+capi_push_many(SPMCQueue* queue, PyObject** items, size_t howmany)
+{
+    return try_push_many(queue, (void **)items, howmany);
+}
+
+static size_t
+capi_pop_many(SPMCQueue* queue, PyObject** items, size_t howmany)
+{
+    return try_pop_many(queue, (void **)items, howmany);
+}
+
+static int
+capi_put_many(PyObject* lq, PyObject* const* items, size_t howmany)
+{
+    if (capi_get_queue(lq) == NULL) {
+        return -1;
+    }
+    if (howmany > ((PyLossyQueue*)lq)->queue_size) {
+        PyErr_SetString(PyExc_ValueError,
+          "batch size must not exceed queue capacity");
+        return -1;
+    }
+    for (size_t i = 0; i < howmany; i++) {
+        Py_INCREF(items[i]);
+    }
+    lossy_push_many((PyLossyQueue*)lq, items, howmany);
+    return 0;
+}
+
+static const LossyQueue_CAPI LossyQueue_capi = {
+    .version = LOSSYQUEUE_CAPI_VERSION,
+    .struct_size = sizeof(LossyQueue_CAPI),
+    .type = &PyLossyQueueType,
+    .get_queue = capi_get_queue,
+    .push_many = capi_push_many,
+    .pop_many = capi_pop_many,
+    .put_many = capi_put_many,
+};
+
 static struct PyModuleDef LossyQueue_module = {
     PyModuleDef_HEAD_INIT,
     .m_name = MODULE_NAME_STR,
@@ -198,6 +261,7 @@ static struct PyModuleDef LossyQueue_module = {
 // Module initialization function
 PyMODINIT_FUNC PY_INIT_FUNC(void) {
     PyObject* module;
+    PyObject* capi;
     if (PyType_Ready(&PyLossyQueueType) < 0)
         return NULL;
 
@@ -208,5 +272,13 @@ PyMODINIT_FUNC PY_INIT_FUNC(void) {
     Py_INCREF(&PyLossyQueueType);
     PyModule_AddObject(module, MODULE_NAME_STR, (PyObject*)&PyLossyQueueType);
 
+    capi = PyCapsule_New((void *)&LossyQueue_capi, MODULE_NAME_STR "._C_API",
+      NULL);
+    if (capi == NULL || PyModule_AddObject(module, "_C_API", capi) < 0) {
+        Py_XDECREF(capi);
+        Py_DECREF(module);
+        return NULL;
+    }
+
     return module;
 }
@@ -0,0 +1,311 @@
+#!/usr/bin/env python3
+"""Benchmarks for the LossyQueue Python binding.
+
+Measures the per-item cost of put(), put_many() and get() on a single
+thread, put() also into a full queue where every item overwrites the
+oldest one (put_overwrite), and the end-to-end throughput of one producer
+feeding several consumer threads, for the release (LossyQueue) and debug
+(LossyQueue_debug) modules built by setup.py. queue.Queue and
+collections.deque are measured the same way for comparison.
+
+Uses pyperf when it is installed (pass pyperf options such as --fast,
+--rigorous or -o result.json after the script's own options), otherwise
+falls back to a simple best-of-N timer:
+
+    python setup.py build_ext --inplace
+    python python/bench_lossyqueue.py
+    python python/bench_lossyqueue.py --impl LossyQueue --threads 1,2,4 --fast
+"""
+
+import argparse
+import collections
+import os
+import queue
+import sys
+import threading
+import time
+
+try:
+    import pyperf
+except ImportError:
+    pyperf = None
+
+QUEUE_SIZE = 1024
+DEF_BATCHES = '1,8,64'
+DEF_THREADS = '1,2,4'
+MT_ITEMS = 20000
+
+# "setup.py build_ext --inplace" puts the modules in the repository root
+sys.path.insert(0, os.path.dirname(os.path.dirname(os.path.abspath(__file__))))
+
+
+class StdQueue:
+    """queue.Queue with the drop-oldest semantics of LossyQueue."""
+
+    def __init__(self, size):
+        self.q = queue.Queue(size)
+
+    def put(self, item):
+        while True:
+            try:
+                self.q.put_nowait(item)
+                return
+            except queue.Full:
+                try:
+                    self.q.get_nowait()
+                except queue.Empty:
+                    pass
+
+    def put_many(self, items):
+        for item in items:
+            self.put(item)
+
+    def get(self):
+        try:
+            return self.q.get_nowait()
+        except queue.Empty:
+            return None
+
+
+class Deque:
+    """Bounded deque: append() drops the oldest item when full."""
+
+    def __init__(self, size):
+        self.d = collections.deque(maxlen=size)
+
+    def put(self, item):
+        self.d.append(item)
+
+    def put_many(self, items):
+        self.d.extend(items)
+
+    def get(self):
+        try:
+            return self.d.popleft()
+        except IndexError:
+            return None
+
+
+def load_impls():
+    impls = {}
+    try:
+        from LossyQueue import LossyQueue
+        impls['LossyQueue'] = LossyQueue
+    except ImportError:
+        pass
+    try:
+        from LossyQueue_debug import LossyQueue_debug
+        impls['LossyQueue_debug'] = LossyQueue_debug
+    except ImportError:
+        pass
+    if not impls:
+        sys.stderr.write('warning: LossyQueue modules not found, run '
+          '"python setup.py build_ext --inplace" first\n')
+    impls['queue.Queue'] = StdQueue
+    impls['deque'] = Deque
+    return impls
+
+
+# Time functions: take the number of loops, return the elapsed seconds.
+# Each loop moves one item (batch=1) or one batch.
+
+def drain(q):
+    get = q.get
+    while get() is not None:
+        pass
+
+
+def bench_put(loops, cls):
+    q = cls(QUEUE_SIZE)
+    put = q.put
+    elapsed = 0.0
+    while loops > 0:
+        # Never fill the queue up, drain outside of the timed section
+        n = min(loops, QUEUE_SIZE)
+        t0 = time.perf_counter()
+        for i in range(n):
+            put(i)
+        elapsed += time.perf_counter() - t0
+        drain(q)
+        loops -= n
+    return elapsed
+
+
+def bench_put_overwrite(loops, cls):
+    """put() into a full queue: every item drops the oldest one."""
+    q = cls(QUEUE_SIZE)
+    put = q.put
+    for i in range(QUEUE_SIZE):
+        put(i)
+    t0 = time.perf_counter()
+    for i in range(loops):
+        put(i)
+    return time.perf_counter() - t0
+
+
+def bench_put_many(loops, cls, batch):
+    q = cls(QUEUE_SIZE)
+    put_many = q.put_many
+    items = list(range(batch))
+    elapsed = 0.0
+    while loops > 0:
+        n = min(loops, max(QUEUE_SIZE // batch, 1))
+        t0 = time.perf_counter()
+        for _ in range(n):
+            put_many(items)
+        elapsed += time.perf_counter() - t0
+        drain(q)
+        loops -= n
+    return elapsed
+
+
+def bench_get(loops, cls):
+    q = cls(QUEUE_SIZE)
+    get = q.get
+    elapsed = 0.0
+    while loops > 0:
+        # Refill outside of the timed section
+        n = min(loops, QUEUE_SIZE)
+        for i in range(n):
+            q.put(i)
+        t0 = time.perf_counter()
+        for _ in range(n):
+            get()
+        elapsed += time.perf_counter() - t0
+        loops -= n
+    return elapsed
+
+
+def bench_threads(loops, cls, nconsumers, batch):
+    """One producer and nconsumers polling consumer threads; the time is
+    from the first put until every consumer has seen the end of stream."""
+    q = cls(QUEUE_SIZE)
+    done = threading.Event()
+    items = list(range(batch))
+
+    def consumer():
+        get = q.get
+        while get() is not None or not done.is_set():
+            pass
+        # Drain what is left after the producer finished
+        while get() is not None:
+            pass
+
+    threads = [threading.Thread(target=consumer) for _ in range(nconsumers)]
+    for t in threads:
+        t.start()
+    t0 = time.perf_counter()
+    if batch == 1:
+        put = q.put
+        for i in range(loops):
+            put(i)
+    else:
+        put_many = q.put_many
+        for _ in range(loops):
+            put_many(items)
+    done.set()
+    for t in threads:
+        t.join()
+    return time.perf_counter() - t0
+
+
+def bench_threads_fixed(loops, cls, nconsumers, batch):
+    # Fixed amount of work per loop, so that thread start-up is amortized
+    return sum(bench_threads(MT_ITEMS // batch, cls, nconsumers, batch)
+      for _ in range(loops))
+
+
+def check_impls(args, impls):
+    missing = [name for name in args.impl or () if name not in impls]
+    if missing:
+        sys.exit(f'error: implementation(s) not available: '
+          f'{", ".join(missing)}')
+
+
+def make_cases(args, impls):
+    """Yield (name, items per loop, time function, extra args)."""
+    check_impls(args, impls)
+    batches = [int(b) for b in args.batch.split(',')]
+    nthreads = [int(t) for t in args.threads.split(',')]
+    for name, cls in impls.items():
+        if args.impl and name not in args.impl:
+            continue
+        if not args.mt_only:
+            yield f'{name}.put', 1, bench_put, (cls,)
+            yield f'{name}.put_overwrite', 1, bench_put_overwrite, (cls,)
+            yield f'{name}.get', 1, bench_get, (cls,)
+            for b in batches:
+                if b > 1:
+                    yield (f'{name}.put_many[{b}]', b, bench_put_many,
+                      (cls, b))
+        if not args.st_only:
+            for n in nthreads:
+                for b in batches:
+                    yield (f'{name}.1p{n}c[batch={b}]',
+                      (MT_ITEMS // b) * b, bench_threads_fixed, (cls, n, b))
+
+
+def add_cmdline_args(cmd, args):
+    for opt in ('impl', 'batch', 'threads'):
+        val = getattr(args, opt)
+        if val:
+            cmd.extend((f'--{opt}', val if isinstance(val, str) else
+              ','.join(val)))
+    if args.st_only:
+        cmd.append('--st-only')
+    if args.mt_only:
+        cmd.append('--mt-only')
+
+
+def add_args(parser):
+    parser.add_argument('--impl', type=lambda s: s.split(','),
+      help='comma separated implementations to run (LossyQueue, '
+      'LossyQueue_debug, queue.Queue, deque), default: all')
+    parser.add_argument('--batch', default=DEF_BATCHES,
+      help=f'comma separated batch sizes (default: {DEF_BATCHES})')
+    parser.add_argument('--threads', default=DEF_THREADS,
+      help=f'comma separated consumer thread counts (default: {DEF_THREADS})')
+    parser.add_argument('--st-only', action='store_true',
+      help='only the single-threaded benchmarks')
+    parser.add_argument('--mt-only', action='store_true',
+      help='only the producer/consumer benchmarks')
+
+
+def run_pyperf(impls):
+    runner = pyperf.Runner(add_cmdline_args=add_cmdline_args)
+    add_args(runner.argparser)
+    args = runner.parse_args()
+    runner.metadata['queue_size'] = QUEUE_SIZE
+    for name, per_loop, func, fargs in make_cases(args, impls):
+        runner.bench_time_func(name, func, *fargs, inner_loops=per_loop)
+
+
+def run_fallback(impls):
+    parser = argparse.ArgumentParser(description=__doc__,
+      formatter_class=argparse.RawDescriptionHelpFormatter)
+    add_args(parser)
+    parser.add_argument('--repeat', type=int, default=5,
+      help='timing repetitions, the best one is reported (default: 5)')
+    args = parser.parse_args()
+    print('pyperf not installed, using a simple best-of-%d timer'
+      % args.repeat)
+    for name, per_loop, func, fargs in make_cases(args, impls):
+        # Calibrate to roughly 0.1 s per repetition
+        loops = 1
+        while func(loops, *fargs) < 0.1:
+            loops *= 2
+        best = min(func(loops, *fargs) for _ in range(args.repeat))
+        ns = best * 1e9 / (loops * per_loop)
+        print(f'{name:40s} {ns:10.1f} ns/item')
+
+
+def main():
+    impls = load_impls()
+    if pyperf is not None:
+        run_pyperf(impls)
+    else:
+        run_fallback(impls)
+
+
+if __name__ == '__main__':
+    main()
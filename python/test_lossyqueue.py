@@ -1,3 +1,4 @@
+import ctypes
 import sys
 import unittest
 #from LossyQueue_debug import LossyQueue
@@ -66,6 +67,80 @@ class TestLossyQueue(unittest.TestCase):
         with self.assertRaises(ValueError):
             queue.put_many([13, 14, 15, 16, 17])
 
+    def test_capi(self):
+        mod = sys.modules[self.lq_class.__module__]
+        get_pointer = ctypes.pythonapi.PyCapsule_GetPointer
+        get_pointer.restype = ctypes.c_void_p
+        get_pointer.argtypes = [ctypes.py_object, ctypes.c_char_p]
+        incref = ctypes.pythonapi.Py_IncRef
+        incref.argtypes = [ctypes.py_object]
+        decref = ctypes.pythonapi.Py_DecRef
+        decref.argtypes = [ctypes.c_void_p]
+
+        # Mirrors LossyQueue_CAPI from LossyQueue_capi.h
+        objs = ctypes.POINTER(ctypes.py_object)
+        class CAPI(ctypes.Structure):
+            _fields_ = [
+                ('version', ctypes.c_uint),
+                ('struct_size', ctypes.c_size_t),
+                ('type', ctypes.c_void_p),
+                ('get_queue', ctypes.PYFUNCTYPE(ctypes.c_void_p,
+                  ctypes.py_object)),
+                ('push_many', ctypes.CFUNCTYPE(ctypes.c_size_t,
+                  ctypes.c_void_p, objs, ctypes.c_size_t)),
+                ('pop_many', ctypes.CFUNCTYPE(ctypes.c_size_t,
+                  ctypes.c_void_p, ctypes.POINTER(ctypes.c_void_p),
+                  ctypes.c_size_t)),
+                ('put_many', ctypes.PYFUNCTYPE(ctypes.c_int,
+                  ctypes.py_object, objs, ctypes.c_size_t)),
+            ]
+
+        ptr = get_pointer(mod._C_API, f'{mod.__name__}._C_API'.encode())
+        api = CAPI.from_address(ptr)
+        self.assertEqual(api.version, 1)
+        self.assertGreaterEqual(api.struct_size, ctypes.sizeof(CAPI))
+
+        queue = self.lq_class(4)
+        q = api.get_queue(queue)
+        self.assertTrue(q)
+        with self.assertRaises(TypeError):
+            api.get_queue(object())
+        uninit = self.lq_class.__new__(self.lq_class)
+        with self.assertRaises(RuntimeError):
+            api.get_queue(uninit)
+
+        # Lossy put of borrowed references
+        items = (ctypes.py_object * 6)(*[f'item{i}' for i in range(6)])
+        with self.assertRaises(RuntimeError):
+            api.put_many(uninit, items, 1)
+        # Same limit as put_many()
+        with self.assertRaises(ValueError):
+            api.put_many(queue, items, 6)
+        self.assertIsNone(queue.get())
+        self.assertEqual(api.put_many(queue, items, 4), 0)
+        self.assertEqual(api.put_many(queue, items, 2), 0)
+        self.assertEqual([queue.get() for _ in range(4)],
+          ['item2', 'item3', 'item0', 'item1'])
+        self.assertIsNone(queue.get())
+
+        # Raw push steals the references of what was pushed
+        items = (ctypes.py_object * 5)(*[('raw', i) for i in range(5)])
+        for i in range(5):
+            incref(items[i])
+        self.assertEqual(api.push_many(q, items, 5), 4)
+        decref(ctypes.cast(items, ctypes.POINTER(ctypes.c_void_p))[4])
+
+        # Raw pop hands back new references
+        out = (ctypes.c_void_p * 8)()
+        n = api.pop_many(q, out, 8)
+        self.assertEqual(n, 4)
+        popped = [ctypes.cast(out[i], ctypes.py_object).value
+          for i in range(n)]
+        for i in range(n):
+            decref(out[i])
+        self.assertEqual(popped, [('raw', i) for i in range(4)])
+        self.assertIsNone(queue.get())
+
 class TestLossyQueueDebug(TestLossyQueue):
     from LossyQueue_debug import LossyQueue_debug
     lq_class = LossyQueue_debug
@@ -54,6 +54,7 @@ setup (name = 'RTQueue',
        version = '1.1',
        description = 'This is a package for LossyQueue module',
        ext_modules = [module1, module2],
+       headers = ['python/LossyQueue_capi.h'],
        cmdclass={'test': PyTestCommand} if PyTestCommand else {},
        long_description=long_description,
        long_description_content_type='text/markdown',
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdlib.h>
+#if defined(_WIN32)
+#include <malloc.h>
+#endif
+
+#if !defined(CACHE_LINE_SIZE)
+#define CACHE_LINE_SIZE 64 // Common cache line size
+#endif
+
+static inline size_t
+round_up_size(size_t size, size_t alignment)
+{
+    return (size + alignment - 1) & ~(alignment - 1);
+}
+
+static inline void *
+spmc_aligned_alloc(size_t alignment, size_t size)
+{
+    size_t alloc_size = round_up_size(size, alignment);
+#if defined(_WIN32)
+    return _aligned_malloc(alloc_size, alignment);
+#else
+    void *ptr = NULL;
+    if (posix_memalign(&ptr, alignment, alloc_size) != 0) {
+        return NULL;
+    }
+    return ptr;
+#endif
+}
+
+static inline void
+spmc_aligned_free(void *ptr)
+{
+#if defined(_WIN32)
+    _aligned_free(ptr);
+#else
+    free(ptr);
+#endif
+}
@@ -0,0 +1,140 @@
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+
+#include "SPMCBufPool.h"
+#include "SPMCAlloc.h"
+
+// The return ring is a bounded MPSC queue with a sequence number per cell:
+// a cell is free for the put at position pos when seq == pos, and holds a
+// buffer for the get at position pos when seq == pos + 1. Its capacity is
+// at least the number of buffers, so a put never finds it full.
+struct bufpool_cell {
+    _Atomic uint64_t seq;
+    void* buf;
+};
+
+struct SPMCBufPool {
+    size_t bufsize;
+    size_t nbufs;
+    uint64_t mask;
+    char* slab;
+    struct bufpool_cell* cells;
+    _Alignas(CACHE_LINE_SIZE) _Atomic uint64_t putIdx;
+    _Alignas(CACHE_LINE_SIZE) uint64_t getIdx;
+};
+
+SPMCBufPool *
+create_bufpool(size_t bufsize, size_t nbufs)
+{
+    SPMCBufPool* pool;
+    size_t ncells = 1;
+
+    assert(bufsize > 0 && nbufs > 0);
+
+    while (ncells < nbufs) {
+        ncells <<= 1;
+    }
+    pool = spmc_aligned_alloc(CACHE_LINE_SIZE, sizeof(SPMCBufPool));
+    if (pool == NULL) {
+        return NULL;
+    }
+    // Keep every buffer on its own cache lines
+    pool->bufsize = round_up_size(bufsize, CACHE_LINE_SIZE);
+    pool->nbufs = nbufs;
+    pool->mask = ncells - 1;
+    pool->slab = spmc_aligned_alloc(CACHE_LINE_SIZE, pool->bufsize * nbufs);
+    pool->cells = spmc_aligned_alloc(CACHE_LINE_SIZE,
+      sizeof(pool->cells[0]) * ncells);
+    if (pool->slab == NULL || pool->cells == NULL) {
+        spmc_aligned_free(pool->slab);
+        spmc_aligned_free(pool->cells);
+        spmc_aligned_free(pool);
+        return NULL;
+    }
+    for (size_t i = 0; i < ncells; i++) {
+        atomic_init(&pool->cells[i].seq, i);
+        pool->cells[i].buf = NULL;
+    }
+    atomic_init(&pool->putIdx, 0);
+    pool->getIdx = 0;
+    for (size_t i = 0; i < nbufs; i++) {
+        bufpool_put(pool, pool->slab + i * pool->bufsize);
+    }
+    return pool;
+}
+
+void
+destroy_bufpool(SPMCBufPool* pool)
+{
+    spmc_aligned_free(pool->slab);
+    spmc_aligned_free(pool->cells);
+    spmc_aligned_free(pool);
+}
+
+void *
+bufpool_get(SPMCBufPool* pool)
+{
+    uint64_t pos = pool->getIdx;
+    struct bufpool_cell* cell = &pool->cells[pos & pool->mask];
+    void* buf;
+
+    if (atomic_load_explicit(&cell->seq, memory_order_acquire) != pos + 1) {
+        // Every buffer is in flight
+        return NULL;
+    }
+    buf = cell->buf;
+    atomic_store_explicit(&cell->seq, pos + pool->mask + 1,
+      memory_order_release);
+    pool->getIdx = pos + 1;
+    return buf;
+}
+
+void
+bufpool_put(SPMCBufPool* pool, void* buf)
+{
+    uint64_t pos = atomic_load_explicit(&pool->putIdx, memory_order_relaxed);
+    struct bufpool_cell* cell;
+
+    assert((char*)buf >= pool->slab &&
+      (char*)buf < pool->slab + pool->bufsize * pool->nbufs &&
+      ((size_t)((char*)buf - pool->slab) % pool->bufsize) == 0);
+
+    for (;;) {
+        cell = &pool->cells[pos & pool->mask];
+        int64_t dif = (int64_t)(atomic_load_explicit(&cell->seq,
+          memory_order_acquire) - pos);
+
+        // dif < 0 would mean the ring is full, which more puts than
+        // buffers (double free) is the only way to get
+        assert(dif >= 0);
+        if (dif == 0 && atomic_compare_exchange_weak_explicit(&pool->putIdx,
+          &pos, pos + 1, memory_order_relaxed, memory_order_relaxed)) {
+            break;
+        }
+        if (dif != 0) {
+            pos = atomic_load_explicit(&pool->putIdx, memory_order_relaxed);
+        }
+    }
+    cell->buf = buf;
+    atomic_store_explicit(&cell->seq, pos + 1, memory_order_release);
+}
+
+size_t
+bufpool_push_lossy(SPMCBufPool* pool, SPMCQueue* queue, void* buf)
+{
+    size_t dropped = 0;
+
+    while (!try_push(queue, buf)) {
+        void* old;
+
+        if (try_pop(queue, &old)) {
+            bufpool_put(pool, old);
+            dropped += 1;
+        }
+    }
+    return dropped;
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "SPMCQueue.h"
+
+// Fixed-size buffer pool paired with an SPMCQueue, so that a producer
+// sending malloc'ed messages to consumers does not have to go through the
+// allocator on every message. All buffers are carved out of one slab at
+// creation time; consumers hand finished buffers back through a lock-free
+// multi-producer return ring and the producer takes them from there.
+
+struct SPMCBufPool;
+
+typedef struct SPMCBufPool SPMCBufPool;
+
+SPMC_API SPMCBufPool* create_bufpool(size_t bufsize, size_t nbufs);
+SPMC_API void destroy_bufpool(SPMCBufPool* pool);
+
+// Take a free buffer, or NULL if all of them are in flight.
+// Producer thread only.
+SPMC_API void* bufpool_get(SPMCBufPool* pool);
+// Return a buffer obtained from bufpool_get(). Any thread.
+SPMC_API void bufpool_put(SPMCBufPool* pool, void* buf);
+// Lossy push of a pool buffer: if the queue is full, the oldest items are
+// dropped and their buffers returned to the pool. Returns the number of
+// items dropped. Producer thread only.
+SPMC_API size_t bufpool_push_lossy(SPMCBufPool* pool, SPMCQueue* queue,
+  void* buf);
@@ -0,0 +1,206 @@
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+
+#include "SPMCPartQueue.h"
+#include "SPMCAlloc.h"
+
+#define PART_NONE SIZE_MAX
+
+struct part {
+    SPMCQueue* queue;
+    _Atomic unsigned int owner;
+    // Set while a consumer holds the partition
+    _Atomic bool busy;
+};
+
+struct part_consumer {
+    size_t held;
+    // Round-robin scan start, so that one hot partition does not starve
+    // the others of the same owner
+    size_t next;
+};
+
+struct SPMCPartQueue {
+    size_t nparts;
+    unsigned int nconsumers;
+    struct part* parts;
+    struct part_consumer* consumers;
+};
+
+// Per-element padding, as each entry is written by a different thread
+#define PADDED_SIZE(t) round_up_size(sizeof(t), CACHE_LINE_SIZE)
+#define PART_AT(pq, i) \
+    ((struct part*)((char*)(pq)->parts + (i) * PADDED_SIZE(struct part)))
+#define CONSUMER_AT(pq, i) ((struct part_consumer*)((char*)(pq)->consumers + \
+    (i) * PADDED_SIZE(struct part_consumer)))
+
+SPMCPartQueue *
+create_part_queue(size_t nparts, size_t part_capacity, unsigned int nconsumers,
+  unsigned int flags)
+{
+    SPMCPartQueue* pqueue;
+
+    assert(nparts > 0 && nconsumers > 0);
+
+    pqueue = malloc(sizeof(SPMCPartQueue));
+    if (pqueue == NULL) {
+        return NULL;
+    }
+    pqueue->nparts = nparts;
+    pqueue->nconsumers = nconsumers;
+    pqueue->parts = spmc_aligned_alloc(CACHE_LINE_SIZE,
+      PADDED_SIZE(struct part) * nparts);
+    pqueue->consumers = spmc_aligned_alloc(CACHE_LINE_SIZE,
+      PADDED_SIZE(struct part_consumer) * nconsumers);
+    if (pqueue->parts == NULL || pqueue->consumers == NULL) {
+        goto e0;
+    }
+    for (size_t i = 0; i < nparts; i++) {
+        struct part* p = PART_AT(pqueue, i);
+
+        p->queue = create_queue_ex(part_capacity, flags);
+        if (p->queue == NULL) {
+            while (i-- > 0) {
+                destroy_queue(PART_AT(pqueue, i)->queue);
+            }
+            goto e0;
+        }
+        atomic_init(&p->owner, (unsigned int)(i % nconsumers));
+        atomic_init(&p->busy, false);
+    }
+    for (unsigned int i = 0; i < nconsumers; i++) {
+        CONSUMER_AT(pqueue, i)->held = PART_NONE;
+        CONSUMER_AT(pqueue, i)->next = 0;
+    }
+    return pqueue;
+e0:
+    spmc_aligned_free(pqueue->parts);
+    spmc_aligned_free(pqueue->consumers);
+    free(pqueue);
+    return NULL;
+}
+
+void
+destroy_part_queue(SPMCPartQueue* pqueue)
+{
+    for (size_t i = 0; i < pqueue->nparts; i++) {
+        destroy_queue(PART_AT(pqueue, i)->queue);
+    }
+    spmc_aligned_free(pqueue->parts);
+    spmc_aligned_free(pqueue->consumers);
+    free(pqueue);
+}
+
+static inline size_t
+part_of(SPMCPartQueue* pqueue, SPMCKeyHashFunc hash, void *cb_arg, void *key)
+{
+    uint64_t h;
+
+    if (hash != NULL) {
+        h = hash(cb_arg, key);
+    } else {
+        // splitmix64 finalizer, pointers have poor low bits
+        h = (uint64_t)(uintptr_t)key;
+        h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+        h ^= h >> 31;
+    }
+    return (size_t)(h % pqueue->nparts);
+}
+
+size_t
+part_push_many_kv(SPMCPartQueue* pqueue, void** keys, size_t howmany,
+  SPMCKeyHashFunc hash, SPMCGetPushFunc get_value, void *cb_arg)
+{
+    size_t consumed = 0, pidx, next = 0;
+
+    if (howmany == 0) {
+        return 0;
+    }
+    pidx = part_of(pqueue, hash, cb_arg, keys[0]);
+    while (consumed < howmany) {
+        size_t run = 1, done;
+
+        // Push each run of keys that map to the same partition in one go,
+        // hashing every key once: the key that ends a run starts the next
+        while (consumed + run < howmany) {
+            next = part_of(pqueue, hash, cb_arg, keys[consumed + run]);
+            if (next != pidx) {
+                break;
+            }
+            run += 1;
+        }
+        done = try_push_many_kv(PART_AT(pqueue, pidx)->queue,
+          keys + consumed, run, get_value, cb_arg);
+        consumed += done;
+        if (done < run) {
+            // Partition full: stop so that later keys do not overtake
+            break;
+        }
+        pidx = next;
+    }
+    return consumed;
+}
+
+void
+part_pop_done(SPMCPartQueue* pqueue, unsigned int consumer_id)
+{
+    struct part_consumer* pc;
+
+    assert(consumer_id < pqueue->nconsumers);
+    pc = CONSUMER_AT(pqueue, consumer_id);
+    if (pc->held != PART_NONE) {
+        // Our processing of its items happens-before the next holder's
+        atomic_store_explicit(&PART_AT(pqueue, pc->held)->busy, false,
+          memory_order_release);
+        pc->held = PART_NONE;
+    }
+}
+
+size_t
+part_pop_many(SPMCPartQueue* pqueue, unsigned int consumer_id, void** values,
+  size_t howmany)
+{
+    struct part_consumer* pc;
+
+    part_pop_done(pqueue, consumer_id);
+    pc = CONSUMER_AT(pqueue, consumer_id);
+
+    // Pass 0 serves the partitions we own, pass 1 steals from the others
+    for (int steal = 0; steal < 2; steal++) {
+        for (size_t i = 0; i < pqueue->nparts; i++) {
+            size_t pidx = (pc->next + i) % pqueue->nparts;
+            struct part* p = PART_AT(pqueue, pidx);
+            bool mine = atomic_load_explicit(&p->owner,
+              memory_order_relaxed) == consumer_id;
+            bool expected = false;
+            size_t n;
+
+            if (mine == (steal != 0) ||
+              atomic_load_explicit(&p->busy, memory_order_relaxed)) {
+                continue;
+            }
+            if (!atomic_compare_exchange_strong_explicit(&p->busy, &expected,
+              true, memory_order_acquire, memory_order_relaxed)) {
+                continue;
+            }
+            n = try_pop_many(p->queue, values, howmany);
+            if (n == 0) {
+                atomic_store_explicit(&p->busy, false, memory_order_release);
+                continue;
+            }
+            if (steal) {
+                atomic_store_explicit(&p->owner, consumer_id,
+                  memory_order_relaxed);
+            }
+            pc->held = pidx;
+            pc->next = pidx + 1;
+            return n;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "SPMCQueue.h"
+
+// Partitioned queue with key affinity. The producer pushes keys, which are
+// hashed onto one of nparts partitions, each backed by its own SPMCQueue.
+// A partition is served by at most one consumer at a time: the consumer
+// that popped from it holds it until its next part_pop_many() (or
+// part_pop_done()) call, so all items of a key are popped and processed in
+// push order. Each partition has an owning consumer; a consumer that finds
+// its own partitions empty steals a whole partition from another consumer
+// and becomes its owner, balancing load without splitting a key's stream.
+
+struct SPMCPartQueue;
+
+typedef struct SPMCPartQueue SPMCPartQueue;
+
+// Map a key onto a 64-bit hash; NULL hashes the key pointer value.
+typedef uint64_t (*SPMCKeyHashFunc)(void *cb_arg, void *key);
+
+// flags are passed to create_queue_ex() for every partition.
+SPMC_API SPMCPartQueue* create_part_queue(size_t nparts, size_t part_capacity,
+  unsigned int nconsumers, unsigned int flags);
+SPMC_API void destroy_part_queue(SPMCPartQueue* pqueue);
+
+// Producer thread only. Like try_push_many_kv(): get_value() turns each key
+// into the value to push (NULL skips the key) and is only called once the
+// key's partition has room. Stops at the first key whose partition is
+// full, returns the number of keys consumed.
+SPMC_API size_t part_push_many_kv(SPMCPartQueue* pqueue, void** keys,
+  size_t howmany, SPMCKeyHashFunc hash, SPMCGetPushFunc get_value,
+  void *cb_arg);
+// Pop up to howmany items, all from a single partition. consumer_id is in
+// [0, nconsumers) and must be used by one thread at a time. Releases the
+// partition held from the previous call first.
+SPMC_API size_t part_pop_many(SPMCPartQueue* pqueue, unsigned int consumer_id,
+  void** values, size_t howmany);
+// Release the partition held by consumer_id without popping more, e.g.
+// before the consumer goes idle or exits.
+SPMC_API void part_pop_done(SPMCPartQueue* pqueue, unsigned int consumer_id);
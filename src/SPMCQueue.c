@@ -5,14 +5,11 @@
 #include <stdatomic.h>
 #include <stdlib.h>
 #include <string.h>
-#if defined(_WIN32)
-#include <malloc.h>
-#endif
 
 #include "SPMCQueue.h"
-
-#if !defined(CACHE_LINE_SIZE)
-#define CACHE_LINE_SIZE 64 // Common cache line size
+#include "SPMCAlloc.h"
+#if defined(SPMC_TRACE)
+#include "SPMCTrace.h"
 #endif
 
 #if defined(NDEBUG)
@@ -35,50 +32,50 @@
 
 #define RESERVED_BITS 4
 
+#define SLOTS_PER_LINE (CACHE_LINE_SIZE / sizeof(void*))
+
 struct SPMCQueue {
     size_t capacity;
     uint64_t mask;
+    // Swizzled slot layout (SPMC_SLOTS_SWIZZLED), see swizzle_idx()
+    bool swizzled;
+    unsigned int swz_lshift;
+    unsigned int swz_hshift;
+    uint64_t swz_lmask;
     _Alignas(CACHE_LINE_SIZE) _Atomic uint64_t writeIdx;
     _Alignas(CACHE_LINE_SIZE) uint64_t readIdxCache;
+    // Producer-private: next slot to write, runs ahead of writeIdx by the
+    // number of staged but not yet published items (push_stage())
+    uint64_t stageIdx;
+    size_t stageLimit;
     _Alignas(CACHE_LINE_SIZE) _Atomic uint64_t readIdx;
+    // Consumers registered with consumer_ctx_init()
+    _Atomic unsigned int activeConsumers;
     _Alignas(CACHE_LINE_SIZE) _Atomic uint64_t writeIdxCache;
     _Alignas(CACHE_LINE_SIZE) void* slots[0]; // FAM for void pointer type slots
 };
 
-static size_t
-round_up_size(size_t size, size_t alignment)
+static unsigned int
+log2_size(size_t v)
 {
-    return (size + alignment - 1) & ~(alignment - 1);
-}
+    unsigned int r = 0;
 
-static void *
-spmc_aligned_alloc(size_t alignment, size_t size)
-{
-    size_t alloc_size = round_up_size(size, alignment);
-#if defined(_WIN32)
-    return _aligned_malloc(alloc_size, alignment);
-#else
-    void *ptr = NULL;
-    if (posix_memalign(&ptr, alignment, alloc_size) != 0) {
-        return NULL;
+    while (v > 1) {
+        v >>= 1;
+        r += 1;
     }
-    return ptr;
-#endif
+    return r;
 }
 
-static void
-spmc_aligned_free(void *ptr)
+// Function to create a new queue
+SPMCQueue *
+create_queue(size_t capacity)
 {
-#if defined(_WIN32)
-    _aligned_free(ptr);
-#else
-    free(ptr);
-#endif
+    return create_queue_ex(capacity, 0);
 }
 
-// Function to create a new queue
 SPMCQueue *
-create_queue(size_t capacity)
+create_queue_ex(size_t capacity, unsigned int flags)
 {
     size_t alloc_size = sizeof(SPMCQueue) + sizeof(void*) * capacity;
 
@@ -91,10 +88,27 @@ create_queue(size_t capacity)
     }
     queue->capacity = capacity;
     queue->mask = capacity - 1;
+    // Swizzling needs at least two slot lines to spread over
+    queue->swizzled = (flags & SPMC_SLOTS_SWIZZLED) != 0 &&
+      capacity >= 2 * SLOTS_PER_LINE;
+    if (queue->swizzled) {
+        size_t nlines = capacity / SLOTS_PER_LINE;
+
+        queue->swz_lmask = nlines - 1;
+        queue->swz_lshift = log2_size(SLOTS_PER_LINE);
+        queue->swz_hshift = log2_size(nlines);
+    } else {
+        queue->swz_lmask = 0;
+        queue->swz_lshift = 0;
+        queue->swz_hshift = 0;
+    }
     atomic_init(&queue->writeIdx, 0);
     atomic_init(&queue->readIdx, 0);
+    atomic_init(&queue->activeConsumers, 0);
     atomic_init(&queue->writeIdxCache, 0);
     queue->readIdxCache = 0;
+    queue->stageIdx = 0;
+    queue->stageLimit = capacity;
     return queue;
 }
 
@@ -103,47 +117,356 @@ void destroy_queue(SPMCQueue* queue) {
     spmc_aligned_free(queue);
 }
 
+#if defined(SPMC_TRACE)
+// Optional per-thread binary event trace, see SPMCTrace.h for the format
+// and spmc_trace_decode.c for the reader. Compiled out entirely unless the
+// library is built with -DSPMC_TRACE.
+#if defined(_WIN32)
+#error "SPMC_TRACE requires a POSIX system"
+#endif
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <sys/syscall.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#define SPMC_TRACE_DEF_RECORDS (1 << 16)
+
+struct spmc_trace_tls {
+    struct spmc_trace_hdr *hdr;
+    struct spmc_trace_rec *recs;
+    uint64_t mask;
+    uint32_t iters;
+    uint8_t flags;
+    bool failed;
+};
+
+static _Thread_local struct spmc_trace_tls spmc_trace;
+// Unmaps the ring of an exiting thread, see trace_close()
+static pthread_key_t spmc_trace_key;
+static pthread_once_t spmc_trace_once = PTHREAD_ONCE_INIT;
+static bool spmc_trace_key_ok;
+
+static inline uint64_t
+trace_tsc(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#elif defined(__aarch64__)
+    uint64_t v;
+
+    __asm__ volatile("mrs %0, cntvct_el0" : "=r"(v));
+    return v;
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+static uint64_t
+trace_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static size_t
+trace_size(uint64_t nrecords)
+{
+    return sizeof(struct spmc_trace_hdr) +
+      nrecords * sizeof(struct spmc_trace_rec);
+}
+
+static void
+trace_close(void *arg)
+{
+    struct spmc_trace_hdr *hdr = arg;
+
+    // Runs in the exiting thread: stop tracing any queue operations done by
+    // later TLS destructors, the records written so far stay in the file
+    if (spmc_trace.hdr == hdr) {
+        spmc_trace.hdr = NULL;
+        spmc_trace.failed = true;
+    }
+    munmap(hdr, trace_size(hdr->nrecords));
+}
+
+static void
+trace_key_init(void)
+{
+    spmc_trace_key_ok =
+      (pthread_key_create(&spmc_trace_key, trace_close) == 0);
+}
+
+static void
+trace_open(void)
+{
+    const char *dir = getenv("SPMC_TRACE_DIR");
+    const char *nrecs_env = getenv("SPMC_TRACE_RECORDS");
+    uint64_t nrecords = SPMC_TRACE_DEF_RECORDS, tid, ns1, tsc1;
+    struct spmc_trace_hdr *hdr;
+    char path[4096];
+    size_t size;
+    void *map;
+    int fd;
+
+    // Only try once per thread, tracing is best-effort
+    spmc_trace.failed = true;
+    if (nrecs_env != NULL) {
+        nrecords = strtoull(nrecs_env, NULL, 0);
+    }
+    if (nrecords == 0 || (nrecords & (nrecords - 1)) != 0) {
+        return;
+    }
+#if defined(__linux__)
+    tid = (uint64_t)syscall(SYS_gettid);
+#else
+    tid = (uint64_t)(uintptr_t)&spmc_trace;
+#endif
+    snprintf(path, sizeof(path), "%s/spmc-trace.%ld.%llu.bin",
+      dir != NULL ? dir : ".", (long)getpid(), (unsigned long long)tid);
+    size = trace_size(nrecords);
+    fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        return;
+    }
+    if (ftruncate(fd, (off_t)size) != 0) {
+        close(fd);
+        return;
+    }
+#if defined(MAP_POPULATE)
+    // Pre-fault the ring so page faults do not show up as op latency
+    map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+      fd, 0);
+#else
+    map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+#endif
+    close(fd);
+    if (map == MAP_FAILED) {
+        return;
+    }
+    hdr = map;
+    hdr->magic = SPMC_TRACE_MAGIC;
+    hdr->version = SPMC_TRACE_VERSION;
+    hdr->record_size = sizeof(struct spmc_trace_rec);
+    hdr->nrecords = nrecords;
+    hdr->pid = (uint64_t)getpid();
+    hdr->tid = tid;
+    hdr->nwritten = 0;
+    // Calibrate TSC against the monotonic clock over ~1ms
+    hdr->ns0 = trace_ns();
+    hdr->tsc0 = trace_tsc();
+    do {
+        ns1 = trace_ns();
+    } while (ns1 - hdr->ns0 < 1000000);
+    tsc1 = trace_tsc();
+    hdr->tsc_per_ns = (double)(tsc1 - hdr->tsc0) / (double)(ns1 - hdr->ns0);
+
+    // Without the key the ring of a thread stays mapped until process exit
+    pthread_once(&spmc_trace_once, trace_key_init);
+    if (spmc_trace_key_ok) {
+        pthread_setspecific(spmc_trace_key, hdr);
+    }
+
+    spmc_trace.hdr = hdr;
+    spmc_trace.recs = (struct spmc_trace_rec *)(hdr + 1);
+    spmc_trace.mask = nrecords - 1;
+    spmc_trace.failed = false;
+}
+
+static inline uint64_t
+trace_begin(void)
+{
+    spmc_trace.iters = 0;
+    spmc_trace.flags = 0;
+    return trace_tsc();
+}
+
+static inline void
+trace_end(const SPMCQueue* queue, uint64_t t0, unsigned int op, uint64_t idx,
+  size_t count)
+{
+    uint64_t t1 = trace_tsc();
+    struct spmc_trace_rec *rec;
+    uint64_t n;
+
+    if (spmc_trace.hdr == NULL) {
+        if (spmc_trace.failed) {
+            return;
+        }
+        trace_open();
+        if (spmc_trace.hdr == NULL) {
+            return;
+        }
+    }
+    n = spmc_trace.hdr->nwritten;
+    rec = &spmc_trace.recs[n & spmc_trace.mask];
+    rec->tsc = t0;
+    rec->duration = (t1 - t0 > UINT32_MAX) ? UINT32_MAX : (uint32_t)(t1 - t0);
+    rec->op = (uint16_t)op;
+    rec->retries = (spmc_trace.iters > 1) ?
+      (uint8_t)((spmc_trace.iters - 1 > UINT8_MAX) ? UINT8_MAX :
+      spmc_trace.iters - 1) : 0;
+    rec->flags = spmc_trace.flags | (count == 0 ? SPMC_TF_NONE : 0);
+    rec->idx = idx;
+    rec->count = (uint32_t)count;
+    rec->queue = (uint32_t)((uintptr_t)queue >> 6);
+    spmc_trace.hdr->nwritten = n + 1;
+}
+
+#define TRACE_BEGIN() \
+    uint64_t _tr_t0 = trace_begin(), _tr_seq = 0; (void)_tr_seq
+#define TRACE_END(q, op, idx, count) \
+    trace_end((q), _tr_t0, (op), (idx), (count))
+#define TRACE_SEQ_PTR (&_tr_seq)
+#define TRACE_SEQ (_tr_seq)
+#define TRACE_ITER() (spmc_trace.iters += 1)
+#define TRACE_FLAG(f) (spmc_trace.flags |= (f))
+#else
+#define TRACE_BEGIN() do { } while (0)
+#define TRACE_END(q, op, idx, count) do { } while (0)
+#define TRACE_SEQ_PTR NULL
+#define TRACE_ITER() ((void)0)
+#define TRACE_FLAG(f) ((void)0)
+#endif
+
 #define LOAD_R_IDX(q, mo) \
     (atomic_load_explicit(&(q)->readIdx,             (mo)))
 #define LOAD_W_IDX(q, mo) \
     (atomic_load_explicit(&(q)->writeIdx,            (mo)))
+// writeIdxCache hands a writeIdx value from one consumer to the others, so
+// it has to carry the producer's release along: a consumer that trusts it
+// without reading writeIdx must still see the slots it covers.
 #define LOAD_W_CACHE(q)   \
-    (atomic_load_explicit(&(q)->writeIdxCache,       memory_order_relaxed))
+    (atomic_load_explicit(&(q)->writeIdxCache,       memory_order_acquire))
 #define UPDATE_R_IDX(q, ov, nv) \
     (atomic_compare_exchange_weak_explicit(&(q)->readIdx, &(ov), (nv), \
                                                      memory_order_release, \
                                                      memory_order_relaxed))
+// Only the model checking harness overrides this, to check that it
+// catches a publication bug
+#ifndef SPMC_PUBLISH_ORDER
+#define SPMC_PUBLISH_ORDER memory_order_release
+#endif
 #define UPDATE_W_IDX(q, v) \
-    (atomic_store_explicit(&(q)->writeIdx,      (v), memory_order_release))
+    (atomic_store_explicit(&(q)->writeIdx,      (v), SPMC_PUBLISH_ORDER))
+#define LOAD_S_IDX(q) \
+    ((q)->stageIdx)
+// Publish everything written up to v, staged items included
+#define PUBLISH_W_IDX(q, v) do { \
+    (q)->stageIdx = (v);         \
+    UPDATE_W_IDX((q), (v));      \
+} while (0)
+// Publish the staged items up to v on a push that writes nothing
+#define FLUSH_W_IDX(q, v) do {                         \
+    if (LOAD_W_IDX((q), memory_order_relaxed) != (v)) \
+        UPDATE_W_IDX((q), (v));                        \
+} while (0)
 #define UPDATE_W_CACHE(q, v) \
-    (atomic_store_explicit(&(q)->writeIdxCache, (v), memory_order_relaxed))
+    (atomic_store_explicit(&(q)->writeIdxCache, (v), memory_order_release))
 #define REFRESH_R_CACHE(q, v, mo) do { \
     (v) = LOAD_R_IDX((q), (mo));       \
     (q)->readIdxCache = (v);           \
+    TRACE_FLAG(SPMC_TF_REFRESH);       \
 } while (0)
 #define REFRESH_W_CACHE(q, v, mo) do { \
     (v) = LOAD_W_IDX((q), (mo));       \
     UPDATE_W_CACHE((q), (v));          \
+    TRACE_FLAG(SPMC_TF_REFRESH);       \
 } while (0)
+// Swizzled layout: the low bits of the sequence number select the cache
+// line and the next bits select the slot within that line, so consecutive
+// items land on different lines.
+static inline size_t
+swizzle_idx(const SPMCQueue* q, uint64_t idx)
+{
+    return (size_t)(((idx & q->swz_lmask) << q->swz_lshift) |
+      ((idx >> q->swz_hshift) & (SLOTS_PER_LINE - 1)));
+}
+
 #define SLOT_IDX(q, idx) \
-    ((size_t)((idx) & (q)->mask))
+    ((q)->swizzled ? swizzle_idx((q), (idx)) : (size_t)((idx) & (q)->mask))
 #define SLOT_AT(q, idx) \
     ((q)->slots[SLOT_IDX((q), (idx))])
 #define SLOT_PTR(q, idx) \
     (&SLOT_AT((q), (idx)))
 
+static inline void
+copy_to_slots(SPMCQueue* q, uint64_t idx, void** values, size_t count)
+{
+    if (q->swizzled) {
+        for (size_t i = 0; i < count; i++) {
+            SLOT_AT(q, idx + i) = values[i];
+        }
+        return;
+    }
+
+    size_t start = SLOT_IDX(q, idx);
+    size_t first_n = q->capacity - start;
+
+    if (count <= first_n) {
+        memcpy(SLOT_PTR(q, idx), values, count * sizeof(values[0]));
+    } else {
+        memcpy(SLOT_PTR(q, idx), values, first_n * sizeof(values[0]));
+        memcpy(&q->slots[0], values + first_n,
+          (count - first_n) * sizeof(values[0]));
+    }
+}
+
+// Consumers read slots speculatively, before their readIdx CAS; the value
+// is discarded if the CAS fails. The slot reads are kept in this function
+// and in load_slot() so that src/tsan.supp can name just them.
+static inline void
+copy_from_slots(SPMCQueue* q, uint64_t idx, void** values, size_t count)
+{
+    if (q->swizzled) {
+        for (size_t i = 0; i < count; i++) {
+            values[i] = SLOT_AT(q, idx + i);
+        }
+        return;
+    }
+
+    size_t start = SLOT_IDX(q, idx);
+    size_t first_n = q->capacity - start;
+
+    if (count <= first_n) {
+        memcpy(values, SLOT_PTR(q, idx), count * sizeof(values[0]));
+    } else {
+        memcpy(values, SLOT_PTR(q, idx), first_n * sizeof(values[0]));
+        memcpy(values + first_n, &q->slots[0],
+          (count - first_n) * sizeof(values[0]));
+    }
+}
+
+static inline void*
+load_slot(SPMCQueue* q, uint64_t idx)
+{
+    return SLOT_AT(q, idx);
+}
+
 // Function to push an element into the queue.
 // This should be called from a single producer thread.
-bool
-try_push(SPMCQueue* queue, void* value)
+static inline bool
+do_try_push(SPMCQueue* queue, void* value)
 {
-    uint64_t writeIdx = LOAD_W_IDX(queue, memory_order_relaxed);
+    uint64_t writeIdx = LOAD_S_IDX(queue);
     uint64_t nextWriteIdx = writeIdx + 1;
     // If the queue is not full
     uint64_t newsize = nextWriteIdx - queue->readIdxCache;
     if(newsize <= queue->capacity) {
         SLOT_AT(queue, writeIdx) = value;
-        UPDATE_W_IDX(queue, nextWriteIdx);
+        PUBLISH_W_IDX(queue, nextWriteIdx);
         return true;
     }
     // Update the cached index and retry
@@ -151,17 +474,18 @@ try_push(SPMCQueue* queue, void* value)
     newsize = nextWriteIdx - newsize;
     if (newsize <= queue->capacity) {
         SLOT_AT(queue, writeIdx) = value;
-        UPDATE_W_IDX(queue, nextWriteIdx);
+        PUBLISH_W_IDX(queue, nextWriteIdx);
         return true;
     }
     // Queue was full
+    FLUSH_W_IDX(queue, writeIdx);
     return false;
 }
 
-size_t
-try_push_many(SPMCQueue* queue, void** values, size_t howmany)
+static inline size_t
+do_try_push_many(SPMCQueue* queue, void** values, size_t howmany)
 {
-    uint64_t writeIdx = LOAD_W_IDX(queue, memory_order_relaxed);
+    uint64_t writeIdx = LOAD_S_IDX(queue);
     uint64_t readIdx = queue->readIdxCache;
     size_t available = (size_t)(queue->capacity - (writeIdx - readIdx));
 
@@ -175,29 +499,21 @@ try_push_many(SPMCQueue* queue, void** values, size_t howmany)
         count = available;
     }
     if (count == 0) {
+        FLUSH_W_IDX(queue, writeIdx);
         return 0;
     }
 
-    size_t start = SLOT_IDX(queue, writeIdx);
-    size_t first_n = queue->capacity - start;
+    copy_to_slots(queue, writeIdx, values, count);
 
-    if (count <= first_n) {
-        memcpy(SLOT_PTR(queue, writeIdx), values, count * sizeof(values[0]));
-    } else {
-        memcpy(SLOT_PTR(queue, writeIdx), values, first_n * sizeof(values[0]));
-        memcpy(&queue->slots[0], values + first_n,
-          (count - first_n) * sizeof(values[0]));
-    }
-
-    UPDATE_W_IDX(queue, writeIdx + count);
+    PUBLISH_W_IDX(queue, writeIdx + count);
     return count;
 }
 
-size_t
-try_push_many_pre(SPMCQueue* queue, void** values, size_t howmany,
+static inline size_t
+do_try_push_many_pre(SPMCQueue* queue, void** values, size_t howmany,
   SPMCPrePushFunc pre_queue, void *cb_arg)
 {
-    uint64_t writeIdx = LOAD_W_IDX(queue, memory_order_relaxed);
+    uint64_t writeIdx = LOAD_S_IDX(queue);
     uint64_t readIdx = queue->readIdxCache;
     size_t available = (size_t)(queue->capacity - (writeIdx - readIdx));
 
@@ -211,36 +527,34 @@ try_push_many_pre(SPMCQueue* queue, void** values, size_t howmany,
         count = available;
     }
     if (count == 0) {
+        FLUSH_W_IDX(queue, writeIdx);
         return 0;
     }
 
-    size_t start = SLOT_IDX(queue, writeIdx);
-
     for (size_t i = 0; i < count; i++) {
         void *value = values[i];
 
         pre_queue(cb_arg, value);
-        SLOT_AT(queue, start + i) = value;
+        SLOT_AT(queue, writeIdx + i) = value;
     }
 
-    UPDATE_W_IDX(queue, writeIdx + count);
+    PUBLISH_W_IDX(queue, writeIdx + count);
     return count;
 }
 
-size_t
-try_push_many_kv(SPMCQueue* queue, void** keys, size_t howmany,
+static inline size_t
+do_try_push_many_kv(SPMCQueue* queue, void** keys, size_t howmany,
   SPMCGetPushFunc get_value, void *cb_arg)
 {
-    uint64_t writeIdx = LOAD_W_IDX(queue, memory_order_relaxed);
+    uint64_t writeIdx = LOAD_S_IDX(queue);
     uint64_t readIdx = queue->readIdxCache;
     size_t available = (size_t)(queue->capacity - (writeIdx - readIdx));
-    size_t count, consumed, start;
+    size_t count, consumed;
 
     if (available < howmany) {
         REFRESH_R_CACHE(queue, readIdx, memory_order_acquire);
         available = (size_t)(queue->capacity - (writeIdx - readIdx));
     }
-    start = SLOT_IDX(queue, writeIdx);
     consumed = 0;
     count = 0;
     while (consumed < howmany) {
@@ -251,25 +565,80 @@ try_push_many_kv(SPMCQueue* queue, void** keys, size_t howmany,
         }
         value = get_value(cb_arg, keys[consumed]);
         if (value != NULL) {
-            SLOT_AT(queue, start + count) = value;
+            SLOT_AT(queue, writeIdx + count) = value;
             count += 1;
         }
         consumed += 1;
     }
     if (count > 0) {
-        UPDATE_W_IDX(queue, writeIdx + count);
+        PUBLISH_W_IDX(queue, writeIdx + count);
+    } else {
+        FLUSH_W_IDX(queue, writeIdx);
     }
     return consumed;
 }
 
+// Staged push: write the slot now, publish it to the consumers later with
+// a single writeIdx store covering the whole burst. Publication happens on
+// push_flush(), on any other push function, once stageLimit items are
+// pending, or when the ring fills up (so that consumers can drain it).
+static inline bool
+do_push_stage(SPMCQueue* queue, void* value)
+{
+    uint64_t stageIdx = LOAD_S_IDX(queue);
+    uint64_t nextStageIdx = stageIdx + 1;
+    uint64_t readIdx;
+
+    if (nextStageIdx - queue->readIdxCache > queue->capacity) {
+        // Ring would fill: publish the pending burst and re-check
+        FLUSH_W_IDX(queue, stageIdx);
+        REFRESH_R_CACHE(queue, readIdx, memory_order_acquire);
+        if (nextStageIdx - readIdx > queue->capacity) {
+            // Queue was full
+            return false;
+        }
+    }
+    SLOT_AT(queue, stageIdx) = value;
+    if (nextStageIdx - LOAD_W_IDX(queue, memory_order_relaxed) >=
+      queue->stageLimit) {
+        PUBLISH_W_IDX(queue, nextStageIdx);
+    } else {
+        queue->stageIdx = nextStageIdx;
+    }
+    return true;
+}
+
+static inline size_t
+do_push_flush(SPMCQueue* queue)
+{
+    uint64_t stageIdx = LOAD_S_IDX(queue);
+    uint64_t writeIdx = LOAD_W_IDX(queue, memory_order_relaxed);
+
+    if (stageIdx == writeIdx) {
+        return 0;
+    }
+    UPDATE_W_IDX(queue, stageIdx);
+    return (size_t)(stageIdx - writeIdx);
+}
+
+void
+set_push_stage_limit(SPMCQueue* queue, size_t limit)
+{
+    assert(limit > 0);
+    queue->stageLimit = (limit < queue->capacity) ? limit : queue->capacity;
+}
+
 // Function to pop an element from the queue.
 // This can be called from multiple consumer threads.
-bool
-try_pop(SPMCQueue* queue, void** value)
+// The sequence number of the popped item is stored into *seq unless it
+// is NULL; with constant NULL the compiler drops that store entirely.
+static inline bool
+do_try_pop(SPMCQueue* queue, void** value, uint64_t* seq)
 {
     uint64_t readIdx, newReadIdx;
     void *rval;
     do {
+        TRACE_ITER();
         readIdx = LOAD_R_IDX(queue, memory_order_relaxed);
         // If the queue is not empty
         uint64_t writeIdxCache = LOAD_W_CACHE(queue);
@@ -283,18 +652,23 @@ try_pop(SPMCQueue* queue, void** value)
             SPMC_ASSERT(readIdx < writeIdxCache);
         }
         newReadIdx = readIdx + 1;
-        rval  = SLOT_AT(queue, readIdx);
+        rval  = load_slot(queue, readIdx);
     } while (!UPDATE_R_IDX(queue, readIdx, newReadIdx));
     *value = rval;
+    if (seq != NULL) {
+        *seq = readIdx;
+    }
     return true;
 }
 
-size_t
-try_pop_many(SPMCQueue* queue, void** values, size_t howmany)
+static inline size_t
+do_try_pop_many(SPMCQueue* queue, void** values, size_t howmany,
+  uint64_t* seq)
 {
     uint64_t readIdx, newReadIdx;
 
     do {
+        TRACE_ITER();
         readIdx = LOAD_R_IDX(queue, memory_order_relaxed);
         // If the queue is not empty
         uint64_t writeIdxCache = LOAD_W_CACHE(queue);
@@ -310,17 +684,208 @@ try_pop_many(SPMCQueue* queue, void** values, size_t howmany)
         newReadIdx = readIdx + howmany;
         if (newReadIdx > writeIdxCache)
             newReadIdx = writeIdxCache;
-        size_t count = (size_t)(newReadIdx - readIdx);
-        size_t start = SLOT_IDX(queue, readIdx);
-        size_t first_n = queue->capacity - start;
-
-        if (count <= first_n) {
-            memcpy(values, SLOT_PTR(queue, readIdx), count * sizeof(values[0]));
-        } else {
-            memcpy(values, SLOT_PTR(queue, readIdx), first_n * sizeof(values[0]));
-            memcpy(values + first_n, &queue->slots[0],
-              (count - first_n) * sizeof(values[0]));
-        }
+        copy_from_slots(queue, readIdx, values,
+          (size_t)(newReadIdx - readIdx));
     } while (!UPDATE_R_IDX(queue, readIdx, newReadIdx));
+    if (seq != NULL) {
+        *seq = readIdx;
+    }
     return (newReadIdx - readIdx);
 }
+
+// Claim size for pop_adaptive(): an even share of the backlog between the
+// active consumers keeps claims small (latency, fairness) on a lightly
+// loaded queue and lets them grow with the backlog at saturation. Under
+// readIdx contention the share is boosted up to 2x so that every won CAS
+// moves more items.
+static inline size_t
+adaptive_claim(SPMCQueue* queue, const consumer_ctx* ctx, uint64_t backlog,
+  size_t howmany)
+{
+    unsigned int active = atomic_load_explicit(&queue->activeConsumers,
+      memory_order_relaxed);
+    uint64_t claim;
+
+    // Keep the division off the single consumer path
+    claim = (active <= 1) ? backlog : (backlog + active - 1) / active;
+    if (ctx->fail_rate != 0) {
+        claim += claim * (ctx->fail_rate < 256 ? ctx->fail_rate : 256) / 256;
+    }
+    if (claim > backlog)
+        claim = backlog;
+    if (claim > howmany)
+        claim = howmany;
+    return (size_t)claim;
+}
+
+static inline size_t
+do_pop_adaptive(consumer_ctx* ctx, void** values, size_t howmany,
+  uint64_t* seq)
+{
+    SPMCQueue* queue = ctx->queue;
+    uint64_t readIdx, newReadIdx;
+    unsigned int fails = 0;
+    size_t claim;
+
+    for (;;) {
+        TRACE_ITER();
+        readIdx = LOAD_R_IDX(queue, memory_order_relaxed);
+        // If the queue is not empty
+        uint64_t writeIdxCache = LOAD_W_CACHE(queue);
+        if (readIdx >= writeIdxCache) {
+            // Update the cached index and retry
+            REFRESH_W_CACHE(queue, writeIdxCache, memory_order_acquire);
+            if(readIdx == writeIdxCache) {
+                // Queue was empty
+                claim = 0;
+                break;
+            }
+            SPMC_ASSERT(readIdx < writeIdxCache);
+        }
+        claim = adaptive_claim(queue, ctx, writeIdxCache - readIdx, howmany);
+        newReadIdx = readIdx + claim;
+        copy_from_slots(queue, readIdx, values, claim);
+        if (UPDATE_R_IDX(queue, readIdx, newReadIdx)) {
+            break;
+        }
+        fails += 1;
+    }
+    // EWMA with a weight of 1/8 for the latest pop
+    ctx->fail_rate = ctx->fail_rate - ctx->fail_rate / 8 +
+      (fails < 8 ? fails : 8) * 256 / 8;
+    ctx->pops += 1;
+    ctx->cas_fails += fails;
+    if (claim > 0) {
+        ctx->batch = claim;
+    }
+    if (seq != NULL) {
+        *seq = readIdx;
+    }
+    return claim;
+}
+
+// Producer writeIdx right after a push, to recover where it started
+#define TRACE_W_IDX(q) LOAD_S_IDX(q)
+
+bool
+try_push(SPMCQueue* queue, void* value)
+{
+    TRACE_BEGIN();
+    bool r = do_try_push(queue, value);
+    TRACE_END(queue, SPMC_TOP_PUSH, TRACE_W_IDX(queue) - r, r);
+    return r;
+}
+
+size_t
+try_push_many(SPMCQueue* queue, void** values, size_t howmany)
+{
+    TRACE_BEGIN();
+    size_t r = do_try_push_many(queue, values, howmany);
+    TRACE_END(queue, SPMC_TOP_PUSH_MANY, TRACE_W_IDX(queue) - r, r);
+    return r;
+}
+
+size_t
+try_push_many_pre(SPMCQueue* queue, void** values, size_t howmany,
+  SPMCPrePushFunc pre_queue, void *cb_arg)
+{
+    TRACE_BEGIN();
+    size_t r = do_try_push_many_pre(queue, values, howmany, pre_queue, cb_arg);
+    TRACE_END(queue, SPMC_TOP_PUSH_MANY_PRE, TRACE_W_IDX(queue) - r, r);
+    return r;
+}
+
+size_t
+try_push_many_kv(SPMCQueue* queue, void** keys, size_t howmany,
+  SPMCGetPushFunc get_value, void *cb_arg)
+{
+    TRACE_BEGIN();
+    size_t r = do_try_push_many_kv(queue, keys, howmany, get_value, cb_arg);
+    TRACE_END(queue, SPMC_TOP_PUSH_MANY_KV, TRACE_W_IDX(queue), r);
+    return r;
+}
+
+bool
+push_stage(SPMCQueue* queue, void* value)
+{
+    TRACE_BEGIN();
+    bool r = do_push_stage(queue, value);
+    TRACE_END(queue, SPMC_TOP_PUSH_STAGE, TRACE_W_IDX(queue) - r, r);
+    return r;
+}
+
+size_t
+push_flush(SPMCQueue* queue)
+{
+    TRACE_BEGIN();
+    size_t r = do_push_flush(queue);
+    TRACE_END(queue, SPMC_TOP_PUSH_FLUSH, TRACE_W_IDX(queue) - r, r);
+    return r;
+}
+
+bool
+try_pop(SPMCQueue* queue, void** value)
+{
+    TRACE_BEGIN();
+    bool r = do_try_pop(queue, value, TRACE_SEQ_PTR);
+    TRACE_END(queue, SPMC_TOP_POP, TRACE_SEQ, r);
+    return r;
+}
+
+size_t
+try_pop_many(SPMCQueue* queue, void** values, size_t howmany)
+{
+    TRACE_BEGIN();
+    size_t r = do_try_pop_many(queue, values, howmany, TRACE_SEQ_PTR);
+    TRACE_END(queue, SPMC_TOP_POP_MANY, TRACE_SEQ, r);
+    return r;
+}
+
+bool
+try_pop_seq(SPMCQueue* queue, void** value, uint64_t* seq)
+{
+    TRACE_BEGIN();
+    bool r = do_try_pop(queue, value, seq);
+    TRACE_END(queue, SPMC_TOP_POP, r ? *seq : 0, r);
+    return r;
+}
+
+size_t
+try_pop_many_seq(SPMCQueue* queue, void** values, size_t howmany,
+  uint64_t* seq)
+{
+    TRACE_BEGIN();
+    size_t r = do_try_pop_many(queue, values, howmany, seq);
+    TRACE_END(queue, SPMC_TOP_POP_MANY, r ? *seq : 0, r);
+    return r;
+}
+
+void
+consumer_ctx_init(consumer_ctx* ctx, SPMCQueue* queue)
+{
+    ctx->queue = queue;
+    ctx->batch = 1;
+    ctx->fail_rate = 0;
+    ctx->pops = 0;
+    ctx->cas_fails = 0;
+    atomic_fetch_add_explicit(&queue->activeConsumers, 1,
+      memory_order_relaxed);
+}
+
+void
+consumer_ctx_fini(consumer_ctx* ctx)
+{
+    SPMC_ASSERT(atomic_load_explicit(&ctx->queue->activeConsumers,
+      memory_order_relaxed) > 0);
+    atomic_fetch_sub_explicit(&ctx->queue->activeConsumers, 1,
+      memory_order_relaxed);
+}
+
+size_t
+pop_adaptive(consumer_ctx* ctx, void** values, size_t howmany)
+{
+    TRACE_BEGIN();
+    size_t r = do_pop_adaptive(ctx, values, howmany, TRACE_SEQ_PTR);
+    TRACE_END(ctx->queue, SPMC_TOP_POP_ADAPTIVE, TRACE_SEQ, r);
+    return r;
+}
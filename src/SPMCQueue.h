@@ -2,6 +2,7 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 
 #if defined(_WIN32) || defined(__CYGWIN__)
 # if defined(SPMC_BUILD_SHARED)
@@ -22,10 +23,16 @@
 struct SPMCQueue;
 
 typedef struct SPMCQueue SPMCQueue;
+
+// create_queue_ex() flags
+// Map consecutive sequence numbers to different cache lines, so that the
+// producer and the consumers of a near-empty queue do not share slot lines.
+#define SPMC_SLOTS_SWIZZLED 0x1u
 typedef void (*SPMCPrePushFunc)(void *cb_arg, void *value);
 typedef void *(*SPMCGetPushFunc)(void *cb_arg, void *key);
 
 SPMC_API SPMCQueue* create_queue(size_t capacity);
+SPMC_API SPMCQueue* create_queue_ex(size_t capacity, unsigned int flags);
 SPMC_API void destroy_queue(SPMCQueue* queue);
 
 SPMC_API bool try_push(SPMCQueue* queue, void* value);
@@ -34,5 +41,40 @@ SPMC_API size_t try_push_many_pre(SPMCQueue* queue, void** values, size_t howman
   SPMCPrePushFunc pre_queue, void *cb_arg);
 SPMC_API size_t try_push_many_kv(SPMCQueue* queue, void** keys, size_t howmany,
   SPMCGetPushFunc get_value, void *cb_arg);
+// Staged producer API: push_stage() writes the slot without making it
+// visible, push_flush() publishes all staged items with a single writeIdx
+// store and returns how many it published. Staged items are also published
+// by any other push function, once the stage limit (see
+// set_push_stage_limit(), defaults to the capacity) is reached, or when the
+// ring would otherwise fill. Producer thread only.
+SPMC_API bool push_stage(SPMCQueue* queue, void* value);
+SPMC_API size_t push_flush(SPMCQueue* queue);
+SPMC_API void set_push_stage_limit(SPMCQueue* queue, size_t limit);
 SPMC_API bool try_pop(SPMCQueue* queue, void** value);
 SPMC_API size_t try_pop_many(SPMCQueue* queue, void** values, size_t howmany);
+// Same as try_pop()/try_pop_many(), but also return the absolute sequence
+// number of the (first) popped item. Items are numbered from 0 in push order.
+SPMC_API bool try_pop_seq(SPMCQueue* queue, void** value, uint64_t* seq);
+SPMC_API size_t try_pop_many_seq(SPMCQueue* queue, void** values,
+  size_t howmany, uint64_t* seq);
+
+// Per-consumer state for pop_adaptive(), owned by one consumer thread.
+typedef struct consumer_ctx {
+    SPMCQueue* queue;
+    size_t batch;       // Claim size of the last successful pop
+    uint32_t fail_rate; // Moving average of readIdx CAS failures per pop,
+                        // in 1/256ths
+    uint64_t pops;      // Statistics: calls and CAS failures
+    uint64_t cas_fails;
+} consumer_ctx;
+
+// Register/unregister a consumer of queue; the number of registered
+// consumers is one of the inputs of pop_adaptive().
+SPMC_API void consumer_ctx_init(consumer_ctx* ctx, SPMCQueue* queue);
+SPMC_API void consumer_ctx_fini(consumer_ctx* ctx);
+// Like try_pop_many(), but the number of items claimed (at most howmany)
+// is picked from the backlog, the number of active consumers and the
+// recent CAS failure rate: a fair share of the backlog when lightly
+// loaded, larger claims under contention and at saturation.
+SPMC_API size_t pop_adaptive(consumer_ctx* ctx, void** values,
+  size_t howmany);
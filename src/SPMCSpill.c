@@ -0,0 +1,253 @@
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "SPMCSpill.h"
+#include "SPMCAlloc.h"
+
+// Largest chunk of records a consumer copies out before claiming them
+#define SPILL_COPY_BYTES 4096
+
+// The spill file is a ring of records addressed by monotonically growing
+// 64-bit indices, claimed by consumers with a CAS on readIdx exactly like
+// the slots of the in-memory queue. The indices live in memory only.
+struct SPMCSpillQueue {
+    SPMCQueue* queue;
+    char* path;
+    unsigned char* recs;
+    size_t map_size;
+    size_t record_size;
+    uint64_t mask;
+    SPMCSpillEncodeFunc encode;
+    SPMCSpillDecodeFunc decode;
+    void *cb_arg;
+    _Alignas(CACHE_LINE_SIZE) _Atomic uint64_t writeIdx;
+    // Producer-private
+    _Alignas(CACHE_LINE_SIZE) uint64_t readIdxCache;
+    bool spilling;
+    _Alignas(CACHE_LINE_SIZE) _Atomic uint64_t readIdx;
+};
+
+SPMCSpillQueue *
+create_spill_queue(SPMCQueue* queue, const char* path, size_t max_bytes,
+  size_t record_size, SPMCSpillEncodeFunc encode, SPMCSpillDecodeFunc decode,
+  void *cb_arg)
+{
+    SPMCSpillQueue* squeue;
+    size_t nrecs = 1;
+    int fd;
+
+    assert(queue != NULL && path != NULL);
+    assert((record_size == 0 && encode == NULL && decode == NULL) ||
+      (record_size > 0 && record_size <= SPMC_SPILL_MAX_RECORD &&
+      encode != NULL && decode != NULL));
+
+    if (record_size == 0) {
+        record_size = sizeof(void*);
+    }
+    if (max_bytes / record_size == 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+    while (nrecs <= (max_bytes / record_size) / 2) {
+        nrecs <<= 1;
+    }
+    squeue = spmc_aligned_alloc(CACHE_LINE_SIZE, sizeof(SPMCSpillQueue));
+    if (squeue == NULL) {
+        return NULL;
+    }
+    squeue->path = strdup(path);
+    if (squeue->path == NULL) {
+        goto e0;
+    }
+    squeue->queue = queue;
+    squeue->record_size = record_size;
+    squeue->mask = nrecs - 1;
+    squeue->map_size = record_size * nrecs;
+    squeue->encode = encode;
+    squeue->decode = decode;
+    squeue->cb_arg = cb_arg;
+
+    fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        goto e1;
+    }
+    if (ftruncate(fd, (off_t)squeue->map_size) != 0) {
+        goto e2;
+    }
+#if !defined(__APPLE__)
+    // Reserve the blocks now, so that running out of disk space shows up
+    // here and not as SIGBUS in the producer
+    int err = posix_fallocate(fd, 0, (off_t)squeue->map_size);
+    if (err != 0 && err != EOPNOTSUPP && err != EINVAL) {
+        errno = err;
+        goto e2;
+    }
+#endif
+    squeue->recs = mmap(NULL, squeue->map_size, PROT_READ | PROT_WRITE,
+      MAP_SHARED, fd, 0);
+    if (squeue->recs == MAP_FAILED) {
+        goto e2;
+    }
+    close(fd);
+
+    atomic_init(&squeue->writeIdx, 0);
+    atomic_init(&squeue->readIdx, 0);
+    squeue->readIdxCache = 0;
+    squeue->spilling = false;
+    return squeue;
+e2:
+    close(fd);
+    unlink(path);
+e1:
+    free(squeue->path);
+e0:
+    spmc_aligned_free(squeue);
+    return NULL;
+}
+
+void
+destroy_spill_queue(SPMCSpillQueue* squeue)
+{
+    munmap(squeue->recs, squeue->map_size);
+    unlink(squeue->path);
+    free(squeue->path);
+    spmc_aligned_free(squeue);
+}
+
+bool
+spill_push(SPMCSpillQueue* squeue, void* value)
+{
+    uint64_t writeIdx = atomic_load_explicit(&squeue->writeIdx,
+      memory_order_relaxed);
+    unsigned char* rec;
+
+    if (!squeue->spilling) {
+        // Fast path: nothing spilled, the in-memory queue has room
+        if (try_push(squeue->queue, value)) {
+            return true;
+        }
+        squeue->spilling = true;
+    } else if (atomic_load_explicit(&squeue->readIdx,
+      memory_order_acquire) == writeIdx) {
+        // Consumers have drained the spill, go back to the ring
+        squeue->readIdxCache = writeIdx;
+        if (try_push(squeue->queue, value)) {
+            squeue->spilling = false;
+            return true;
+        }
+    }
+
+    if (writeIdx - squeue->readIdxCache > squeue->mask) {
+        squeue->readIdxCache = atomic_load_explicit(&squeue->readIdx,
+          memory_order_acquire);
+        if (writeIdx - squeue->readIdxCache > squeue->mask) {
+            // Spill is full too: drop
+            return false;
+        }
+    }
+    rec = squeue->recs + (writeIdx & squeue->mask) * squeue->record_size;
+    if (squeue->encode != NULL) {
+        squeue->encode(squeue->cb_arg, value, rec);
+    } else {
+        memcpy(rec, &value, sizeof(value));
+    }
+    atomic_store_explicit(&squeue->writeIdx, writeIdx + 1,
+      memory_order_release);
+    return true;
+}
+
+uint64_t
+spill_pending(SPMCSpillQueue* squeue)
+{
+    uint64_t readIdx = atomic_load_explicit(&squeue->readIdx,
+      memory_order_acquire);
+
+    return atomic_load_explicit(&squeue->writeIdx, memory_order_acquire) -
+      readIdx;
+}
+
+static void
+copy_from_spill(SPMCSpillQueue* squeue, uint64_t readIdx, unsigned char* buf,
+  size_t n)
+{
+    size_t first = (size_t)(readIdx & squeue->mask);
+    size_t n1 = (size_t)(squeue->mask + 1) - first;
+
+    if (n1 > n) {
+        n1 = n;
+    }
+    memcpy(buf, squeue->recs + first * squeue->record_size,
+      n1 * squeue->record_size);
+    if (n1 < n) {
+        memcpy(buf + n1 * squeue->record_size, squeue->recs,
+          (n - n1) * squeue->record_size);
+    }
+}
+
+size_t
+spill_pop_many(SPMCSpillQueue* squeue, void** values, size_t howmany)
+{
+    unsigned char buf[SPILL_COPY_BYTES];
+    size_t maxrecs = SPILL_COPY_BYTES / squeue->record_size;
+    uint64_t readIdx, writeIdx;
+    size_t n = try_pop_many(squeue->queue, values, howmany);
+
+    // Anything in the ring is older than what is in the spill: the
+    // producer only spills once the ring is full and only returns to the
+    // ring once the spill is drained.
+    if (n > 0) {
+        return n;
+    }
+    if (howmany > maxrecs) {
+        howmany = maxrecs;
+    }
+    // Same speculative copy + CAS claim as do_try_pop_many()
+    do {
+        readIdx = atomic_load_explicit(&squeue->readIdx, memory_order_relaxed);
+        writeIdx = atomic_load_explicit(&squeue->writeIdx,
+          memory_order_acquire);
+        if (readIdx == writeIdx) {
+            return 0;
+        }
+        // The ring may have been filled right before these records were
+        // spilled; look again so those items are not overtaken. Claiming
+        // from the readIdx seen before this check guarantees the spill was
+        // not drained (letting the producer back into the ring) meanwhile.
+        n = try_pop_many(squeue->queue, values, howmany);
+        if (n > 0) {
+            return n;
+        }
+        n = (size_t)(writeIdx - readIdx);
+        if (n > howmany) {
+            n = howmany;
+        }
+        copy_from_spill(squeue, readIdx, buf, n);
+    } while (!atomic_compare_exchange_weak_explicit(&squeue->readIdx,
+      &readIdx, readIdx + n, memory_order_release, memory_order_relaxed));
+
+    for (size_t i = 0; i < n; i++) {
+        const unsigned char* rec = buf + i * squeue->record_size;
+
+        if (squeue->decode != NULL) {
+            values[i] = squeue->decode(squeue->cb_arg, rec);
+        } else {
+            memcpy(&values[i], rec, sizeof(values[i]));
+        }
+    }
+    return n;
+}
+
+bool
+spill_pop(SPMCSpillQueue* squeue, void** value)
+{
+    return spill_pop_many(squeue, value, 1) == 1;
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "SPMCQueue.h"
+
+// Overflow tier for streams that must survive short consumer stalls
+// without losing data. Instead of failing when the in-memory queue is
+// full, spill_push() appends the item to a memory-mapped spill file of
+// fixed-size records. Once spilling has started the producer keeps
+// appending to the file until consumers have drained it, so items are
+// delivered in push order: first what is in the ring, then the spill,
+// then the ring again. Disk usage is bounded; when the spill file is full
+// as well, spill_push() fails and the item is dropped (lossy fallback).
+//
+// The spill file is scratch space, not a journal: it is not meant to be
+// read back after a restart. POSIX only.
+
+#define SPMC_SPILL_MAX_RECORD 256
+
+struct SPMCSpillQueue;
+
+typedef struct SPMCSpillQueue SPMCSpillQueue;
+
+// Serialize value into a record_size bytes record / recreate it from one.
+// encode() runs on the producer when the item is spilled, decode() on the
+// consumer that claimed the record. Without them the record is the
+// pointer value itself.
+typedef void (*SPMCSpillEncodeFunc)(void *cb_arg, void *value, void *rec);
+typedef void *(*SPMCSpillDecodeFunc)(void *cb_arg, const void *rec);
+
+// Wrap queue (not owned) with a spill file at path of at most max_bytes.
+// record_size is 0 (pointer records) or up to SPMC_SPILL_MAX_RECORD
+// bytes with encode/decode set.
+SPMC_API SPMCSpillQueue* create_spill_queue(SPMCQueue* queue, const char* path,
+  size_t max_bytes, size_t record_size, SPMCSpillEncodeFunc encode,
+  SPMCSpillDecodeFunc decode, void *cb_arg);
+SPMC_API void destroy_spill_queue(SPMCSpillQueue* squeue);
+
+// Producer thread only. Returns false if both the queue and the spill
+// file are full; the item was not consumed.
+SPMC_API bool spill_push(SPMCSpillQueue* squeue, void* value);
+SPMC_API bool spill_pop(SPMCSpillQueue* squeue, void** value);
+SPMC_API size_t spill_pop_many(SPMCSpillQueue* squeue, void** values,
+  size_t howmany);
+// Number of records currently in the spill file.
+SPMC_API uint64_t spill_pending(SPMCSpillQueue* squeue);
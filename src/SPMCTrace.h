@@ -0,0 +1,58 @@
+#pragma once
+
+#include <stdint.h>
+
+// On-disk format of the SPMC_TRACE per-thread event rings, shared between
+// SPMCQueue.c and spmc_trace_decode.c.
+//
+// Each thread that touches a queue maps its own file
+// "<SPMC_TRACE_DIR>/spmc-trace.<pid>.<tid>.bin" consisting of a header
+// followed by a ring of fixed-size records. The writer only ever advances
+// hdr.nwritten, the record for event N lives at slot N % hdr.nrecords.
+
+#define SPMC_TRACE_MAGIC 0x43524d5053435254ULL // "TRCSPMRC"
+#define SPMC_TRACE_VERSION 1
+
+enum spmc_trace_op {
+    SPMC_TOP_PUSH = 1,
+    SPMC_TOP_PUSH_MANY,
+    SPMC_TOP_PUSH_MANY_PRE,
+    SPMC_TOP_PUSH_MANY_KV,
+    SPMC_TOP_POP,
+    SPMC_TOP_POP_MANY,
+    SPMC_TOP_PUSH_STAGE,
+    SPMC_TOP_PUSH_FLUSH,
+    SPMC_TOP_POP_ADAPTIVE,
+    SPMC_TOP_MAX
+};
+
+// Record flags
+#define SPMC_TF_REFRESH 0x1 // Had to refresh the cached peer index
+#define SPMC_TF_NONE 0x2    // Nothing pushed/popped: queue full/empty
+
+struct spmc_trace_hdr {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t record_size;
+    uint64_t nrecords;
+    // TSC <-> CLOCK_MONOTONIC calibration taken when the ring was created
+    uint64_t tsc0;
+    uint64_t ns0;
+    double tsc_per_ns;
+    uint64_t pid;
+    uint64_t tid;
+    uint64_t nwritten;
+    uint8_t pad[16];
+};
+
+struct spmc_trace_rec {
+    uint64_t tsc;      // TSC at operation start
+    uint32_t duration; // TSC ticks spent in the operation
+    uint16_t op;       // enum spmc_trace_op
+    uint8_t retries;   // readIdx CAS failures (saturating)
+    uint8_t flags;     // SPMC_TF_*
+    uint64_t idx;      // readIdx/writeIdx the operation started at
+                       // (writeIdx after the push for _kv)
+    uint32_t count;    // Items pushed/popped (or keys consumed for _kv)
+    uint32_t queue;    // Queue identity (hashed address)
+};
@@ -1,4 +1,5 @@
 #include <assert.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -18,35 +19,58 @@
 #define NUM_SECONDS 10
 #define QUEUE_SIZE 4096
 #define WRKR_BATCH_SIZE 8
+/* Largest claim a pop_adaptive() worker may make */
+#define WRKR_ADAPTIVE_MAX 64
+#define MAX_WORKERS 16
 
-/* End Of Work sentinel */
-#define EOW_SENTINEL ((uintptr_t)-1)
+/* Push timestamps for latency measurement in paced mode (-p) */
+#define TS_RING_SIZE (QUEUE_SIZE * 16)
 
 typedef struct {
     SPMCQueue* queue;
+    bool adaptive;
+    _Atomic bool *done;
+    _Atomic uint64_t *push_ns;
     uint64_t count;
     uint64_t chksum;
+    uint64_t pops;
+    uint64_t cas_fails;
+    uint64_t lat_sum;
+    uint64_t lat_max;
 } WorkerArgs;
 
 #define unlikely(expr) __builtin_expect(!!(expr), 0)
 #define likely(expr) __builtin_expect(!!(expr), 1)
 
+static uint64_t
+now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
 void* worker_thread(void* arg) {
     WorkerArgs* args = (WorkerArgs*) arg;
     SPMCQueue* queue = args->queue;
-    _Alignas(CACHE_LINE_SIZE) void* values[WRKR_BATCH_SIZE] = {};
+    _Alignas(CACHE_LINE_SIZE) void* values[WRKR_ADAPTIVE_MAX] = {};
     uintptr_t last_value = 0;
     int sleepcycles = 0;
+    consumer_ctx ctx;
 
+    consumer_ctx_init(&ctx, queue);
     while (1) {
-        size_t n = try_pop_many(queue, values, WRKR_BATCH_SIZE);
+        bool done = atomic_load_explicit(args->done, memory_order_acquire);
+        size_t n = args->adaptive ?
+          pop_adaptive(&ctx, values, WRKR_ADAPTIVE_MAX) :
+          try_pop_many(queue, values, WRKR_BATCH_SIZE);
         if (likely(n > 0)) {
+            uint64_t now = (args->push_ns != NULL) ? now_ns() : 0;
+
             for (size_t i = 0; i < n; i++) {
                 uintptr_t current_value = (uintptr_t)values[i];
-                if (unlikely(current_value == EOW_SENTINEL)) {
-                    goto out;
-                }
-                if (unlikely(current_value <= last_value && !(last_value + 1 == EOW_SENTINEL && current_value == EOW_SENTINEL + 1))) {
+                if (unlikely(current_value <= last_value)) {
                     printf("Error: Expected value greater than %" PRIuPTR " but got %" PRIuPTR "\n", last_value, current_value);
                     abort();
                     exit(EXIT_FAILURE);
@@ -54,8 +78,19 @@ void* worker_thread(void* arg) {
                 last_value = current_value;
                 args->count += 1;
                 args->chksum += current_value;
+                if (args->push_ns != NULL) {
+                    uint64_t lat = now - atomic_load_explicit(
+                      &args->push_ns[current_value % TS_RING_SIZE],
+                      memory_order_relaxed);
+
+                    args->lat_sum += lat;
+                    if (lat > args->lat_max)
+                        args->lat_max = lat;
+                }
             }
             sleepcycles = sleepcycles * (QUEUE_SIZE - n) / QUEUE_SIZE;
+        } else if (done) {
+            break;
         } else {
             sleepcycles += 1;
         }
@@ -69,7 +104,9 @@ void* worker_thread(void* arg) {
         //delay.tv_nsec = 1;
         //nanosleep(&delay, NULL);
     }
-out:
+    args->pops = ctx.pops;
+    args->cas_fails = ctx.cas_fails;
+    consumer_ctx_fini(&ctx);
     return NULL;
 }
 
@@ -79,14 +116,20 @@ out:
   (double)NSEC(s) / 1000000000.0)
 
 int main(int argc, char *argv[]) {
-    SPMCQueue* queue = create_queue(QUEUE_SIZE);
-    pthread_t worker;
-    WorkerArgs args = {.queue = queue};
+    SPMCQueue* queue;
+    unsigned int qflags = 0;
+    pthread_t workers[MAX_WORKERS];
+    WorkerArgs args[MAX_WORKERS] = {};
+    _Atomic bool done = false;
+    _Atomic uint64_t *push_ns = NULL;
     struct timespec st = {}, et = {};
     int num_seconds = NUM_SECONDS; // default
+    int nworkers = 1;
+    bool adaptive = false;
+    double rate = 0;
     int opt;
 
-    while ((opt = getopt(argc, argv, "t:")) != -1) {
+    while ((opt = getopt(argc, argv, "t:saw:p:")) != -1) {
         switch (opt) {
         case 't':
             num_seconds = atoi(optarg);
@@ -95,15 +138,50 @@ int main(int argc, char *argv[]) {
                 exit(EXIT_FAILURE);
             }
             break;
+        case 's':
+            qflags |= SPMC_SLOTS_SWIZZLED;
+            break;
+        case 'a':
+            adaptive = true;
+            break;
+        case 'w':
+            nworkers = atoi(optarg);
+            if (nworkers <= 0 || nworkers > MAX_WORKERS) {
+                fprintf(stderr, "Number of workers must be 1..%d\n",
+                  MAX_WORKERS);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'p':
+            rate = atof(optarg);
+            if (rate <= 0) {
+                fprintf(stderr, "Rate must be greater than 0\n");
+                exit(EXIT_FAILURE);
+            }
+            break;
         default:
-            fprintf(stderr, "Usage: %s [-t num_seconds]\n", argv[0]);
+            fprintf(stderr, "Usage: %s [-t num_seconds] [-s] [-a] "
+              "[-w workers] [-p msgs_per_second]\n", argv[0]);
             exit(EXIT_FAILURE);
         }
     }
 
-    if (pthread_create(&worker, NULL, worker_thread, &args)) {
-        fprintf(stderr, "Error creating thread\n");
-        return 1;
+    queue = create_queue_ex(QUEUE_SIZE, qflags);
+    if (rate > 0) {
+        // Paced producer: also measure push to pop latency
+        push_ns = calloc(TS_RING_SIZE, sizeof(push_ns[0]));
+        assert(push_ns != NULL);
+    }
+
+    for (int w = 0; w < nworkers; w++) {
+        args[w].queue = queue;
+        args[w].adaptive = adaptive;
+        args[w].done = &done;
+        args[w].push_ns = push_ns;
+        if (pthread_create(&workers[w], NULL, worker_thread, &args[w])) {
+            fprintf(stderr, "Error creating thread\n");
+            return 1;
+        }
     }
 
     clock_gettime(CLOCK_MONOTONIC, &st);
@@ -112,9 +190,18 @@ int main(int argc, char *argv[]) {
     uint64_t i;
     uint64_t disc = 0;
     uint64_t chksum = 0;
+    uint64_t next_ns = now_ns();
+    double interval_ns = (rate > 0) ? 1e9 / rate : 0;
     for (i = 1;;i++) {
-        if (sizeof(uintptr_t) < 8 && unlikely(((uintptr_t)i) == EOW_SENTINEL))
-            i++;
+        if (push_ns != NULL) {
+            uint64_t now;
+
+            next_ns += (uint64_t)interval_ns;
+            while ((now = now_ns()) < next_ns)
+                continue;
+            atomic_store_explicit(&push_ns[i % TS_RING_SIZE], now,
+              memory_order_relaxed);
+        }
         while (unlikely(!try_push(queue, (void*) i))) {
             struct timespec delay = {.tv_nsec = 1};
             nanosleep(&delay, NULL);
@@ -125,7 +212,7 @@ int main(int argc, char *argv[]) {
             }
         }
         chksum += (uintptr_t)i;
-        if (unlikely((((1 << 16) - 1) & i) == 0)) {
+        if (unlikely(push_ns != NULL || (((1 << 16) - 1) & i) == 0)) {
             clock_gettime(CLOCK_MONOTONIC, &et);
             etime = timespec2dtime(&et);
             if (etime >= stime)
@@ -133,22 +220,48 @@ int main(int argc, char *argv[]) {
         }
     }
 
-    while (!try_push(queue, (void *)EOW_SENTINEL)) { sched_yield(); } // Add EOW marker
+    atomic_store_explicit(&done, true, memory_order_release);
 
-    // Wait for the worker thread to exit
-    if (pthread_join(worker, NULL)) {
-        fprintf(stderr, "Error joining thread\n");
-        return 2;
+    // Wait for the worker threads to drain the queue and exit
+    uint64_t received = 0, rchksum = 0, pops = 0, cas_fails = 0;
+    uint64_t lat_sum = 0, lat_max = 0;
+    for (int w = 0; w < nworkers; w++) {
+        if (pthread_join(workers[w], NULL)) {
+            fprintf(stderr, "Error joining thread\n");
+            return 2;
+        }
+        received += args[w].count;
+        rchksum += args[w].chksum;
+        pops += args[w].pops;
+        cas_fails += args[w].cas_fails;
+        lat_sum += args[w].lat_sum;
+        if (args[w].lat_max > lat_max)
+            lat_max = args[w].lat_max;
     }
 
-    assert(chksum == args.chksum);
+    assert(chksum == rchksum);
 #if defined(NDEBUG)
     (void)chksum;
+    (void)rchksum;
 #endif
     double ttime = etime - stime + num_seconds;
-    i--;
-    printf("Sent %" PRIu64 " + %" PRIu64 ", received %" PRIu64 " messages in %.5f seconds\n", i - disc, disc, args.count, ttime);
+    // The loop exits right after pushing i, so messages 1..i were all sent:
+    // "Sent" is i - disc, equal to "received" with nothing lost. Before the
+    // end-of-work sentinel was replaced by the done flag this printed one
+    // message less (i - 1), which the loss rate below was also based on.
+    printf("Sent %" PRIu64 " + %" PRIu64 ", received %" PRIu64 " messages in %.5f seconds\n", i - disc, disc, received, ttime);
     printf("PPS is %.3f MPPS, packet loss rate %.4f%%\n", 1e-6 * (double)(i - disc) / ttime, 100.0 * (double)disc / (double)i);
+    if (adaptive && pops > 0) {
+        printf("pop_adaptive: %d workers, %.2f items/call, %.3f%% CAS failures\n",
+          nworkers, (double)received / (double)pops,
+          100.0 * (double)cas_fails / (double)pops);
+    }
+    if (push_ns != NULL && received > 0) {
+        printf("Latency (%s slots): mean %.3f us, max %.3f us\n",
+          (qflags & SPMC_SLOTS_SWIZZLED) ? "swizzled" : "dense",
+          1e-3 * (double)lat_sum / (double)received, 1e-3 * (double)lat_max);
+        free((void*)push_ns);
+    }
 
     destroy_queue(queue);
     return 0;
@@ -0,0 +1,164 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "SPMCQueue.h"
+#include "SPMCBufPool.h"
+
+#define NBUFS 8
+#define NTHREADS 4
+
+static void
+test_get_put_exhaust(void)
+{
+    SPMCBufPool* pool = create_bufpool(100, NBUFS);
+    void* bufs[NBUFS];
+    void* buf;
+
+    assert(pool != NULL);
+    for (int i = 0; i < NBUFS; i++) {
+        bufs[i] = bufpool_get(pool);
+        assert(bufs[i] != NULL);
+        // Buffers are usable, distinct and cache line aligned
+        memset(bufs[i], i, 100);
+        assert(((uintptr_t)bufs[i] % 64) == 0);
+        for (int j = 0; j < i; j++) {
+            assert(bufs[i] != bufs[j]);
+        }
+    }
+    buf = bufpool_get(pool);
+    assert(buf == NULL);
+
+    bufpool_put(pool, bufs[3]);
+    buf = bufpool_get(pool);
+    assert(buf == bufs[3]);
+    buf = bufpool_get(pool);
+    assert(buf == NULL);
+    for (int i = 0; i < NBUFS; i++) {
+        bufpool_put(pool, bufs[i]);
+    }
+    for (int i = 0; i < NBUFS; i++) {
+        buf = bufpool_get(pool);
+        assert(buf == bufs[i]);
+    }
+    destroy_bufpool(pool);
+}
+
+struct put_args {
+    SPMCBufPool* pool;
+    void* bufs[NBUFS];
+    int n;
+};
+
+static void*
+put_thread(void* arg)
+{
+    struct put_args* pa = arg;
+
+    for (int i = 0; i < pa->n; i++) {
+        bufpool_put(pa->pool, pa->bufs[i]);
+    }
+    return NULL;
+}
+
+static void
+test_concurrent_put(void)
+{
+    SPMCBufPool* pool = create_bufpool(16, NBUFS * NTHREADS);
+    struct put_args pa[NTHREADS];
+    pthread_t threads[NTHREADS];
+    void* seen[NBUFS * NTHREADS];
+    void* buf;
+    int nseen = 0;
+
+    assert(pool != NULL);
+    for (int round = 0; round < 100; round++) {
+        for (int t = 0; t < NTHREADS; t++) {
+            pa[t].pool = pool;
+            pa[t].n = NBUFS;
+            for (int i = 0; i < NBUFS; i++) {
+                pa[t].bufs[i] = bufpool_get(pool);
+                assert(pa[t].bufs[i] != NULL);
+            }
+        }
+        buf = bufpool_get(pool);
+        assert(buf == NULL);
+        for (int t = 0; t < NTHREADS; t++) {
+            if (pthread_create(&threads[t], NULL, put_thread, &pa[t])) {
+                fprintf(stderr, "Error creating thread\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        for (int t = 0; t < NTHREADS; t++) {
+            if (pthread_join(threads[t], NULL)) {
+                fprintf(stderr, "Error joining thread\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+    // Every buffer came back exactly once
+    while (nseen < NBUFS * NTHREADS) {
+        buf = bufpool_get(pool);
+        assert(buf != NULL);
+        for (int i = 0; i < nseen; i++) {
+            assert(seen[i] != buf);
+        }
+        seen[nseen++] = buf;
+    }
+    buf = bufpool_get(pool);
+    assert(buf == NULL);
+    destroy_bufpool(pool);
+}
+
+static void
+test_push_lossy_recycles(void)
+{
+    SPMCBufPool* pool = create_bufpool(32, 6);
+    SPMCQueue* queue = create_queue(4);
+    void* bufs[6];
+    void* value;
+    void* buf;
+    size_t dropped;
+    bool ok;
+
+    assert(pool != NULL && queue != NULL);
+    for (int i = 0; i < 6; i++) {
+        bufs[i] = bufpool_get(pool);
+        assert(bufs[i] != NULL);
+    }
+    for (int i = 0; i < 4; i++) {
+        dropped = bufpool_push_lossy(pool, queue, bufs[i]);
+        assert(dropped == 0);
+    }
+    // Queue is full, the two oldest buffers go back to the pool
+    dropped = bufpool_push_lossy(pool, queue, bufs[4]);
+    assert(dropped == 1);
+    dropped = bufpool_push_lossy(pool, queue, bufs[5]);
+    assert(dropped == 1);
+    buf = bufpool_get(pool);
+    assert(buf == bufs[0]);
+    buf = bufpool_get(pool);
+    assert(buf == bufs[1]);
+    buf = bufpool_get(pool);
+    assert(buf == NULL);
+    for (int i = 2; i < 6; i++) {
+        ok = try_pop(queue, &value);
+        assert(ok && value == bufs[i]);
+    }
+    destroy_queue(queue);
+    destroy_bufpool(pool);
+}
+
+int
+main(void)
+{
+    test_get_put_exhaust();
+    test_concurrent_put();
+    test_push_lossy_recycles();
+    return 0;
+}
@@ -0,0 +1,181 @@
+/*
+ * Model-checking harness for the SPMC queue.
+ *
+ * This is not built by CMake; it is meant to be run through a C11 memory
+ * model checker such as GenMC, which explores every interleaving and every
+ * execution allowed by the weak memory model:
+ *
+ *     genmc --disable-race-detection -- -I src src/spmc_genmc_test.c
+ *
+ * Race detection is off because the speculative slot reads of the
+ * consumers are plain accesses that race with the producer by design;
+ * what is checked instead is that every value a consumer keeps is right.
+ * Building with -DSPMC_PUBLISH_ORDER=memory_order_relaxed turns the
+ * writeIdx release store into a relaxed one, and the check must then
+ * fail: a consumer can see the new writeIdx but not the slot contents.
+ *
+ * The queue implementation is included directly so that the checker sees
+ * the real atomics. A two-slot queue, a lossy producer and two consumers
+ * are enough to hit wrap-around, a full queue, an empty queue and the
+ * readIdx CAS race. The final assertion checks that every item was either
+ * delivered to exactly one consumer or dropped exactly once by the
+ * producer, and that no consumer saw a stale slot.
+ *
+ * -DGENMC_CLIENT=n picks the API mix, one at a time to keep each run small:
+ *
+ *     0 (default)  try_push(); try_pop() and try_pop_many() consumers
+ *     1            push_stage() and try_push_many() with push_flush() at
+ *                  the end, which covers publication of staged items by
+ *                  other pushes, including failed ones on a full ring
+ *     2            try_push(); two registered pop_adaptive() consumers
+ */
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+static int
+genmc_memalign(void **ptr, size_t alignment, size_t size)
+{
+    (void)alignment;
+    *ptr = malloc(size);
+    return (*ptr == NULL);
+}
+#define posix_memalign genmc_memalign
+
+#include "SPMCQueue.c"
+
+#define GENMC_CAPACITY 2
+#define GENMC_ITEMS 4
+#ifndef GENMC_CLIENT
+#define GENMC_CLIENT 0
+#endif
+
+static SPMCQueue* queue;
+static _Atomic int seen[GENMC_ITEMS + 1];
+
+static void
+mark(void *value)
+{
+    uintptr_t v = (uintptr_t)value;
+
+    assert(v >= 1 && v <= GENMC_ITEMS);
+    atomic_fetch_add_explicit(&seen[v], 1, memory_order_relaxed);
+}
+
+#if GENMC_CLIENT != 2
+static void*
+consumer_one(void* arg)
+{
+    void *value;
+
+    (void)arg;
+    if (try_pop(queue, &value))
+        mark(value);
+    if (try_pop(queue, &value))
+        mark(value);
+    return NULL;
+}
+
+static void*
+consumer_many(void* arg)
+{
+    void *values[GENMC_CAPACITY];
+    size_t n;
+
+    (void)arg;
+    n = try_pop_many(queue, values, GENMC_CAPACITY);
+    for (size_t i = 0; i < n; i++)
+        mark(values[i]);
+    return NULL;
+}
+#else
+static void*
+consumer_adaptive(void* arg)
+{
+    void *values[GENMC_CAPACITY];
+    consumer_ctx ctx;
+    size_t n;
+
+    (void)arg;
+    consumer_ctx_init(&ctx, queue);
+    for (int i = 0; i < 2; i++) {
+        n = pop_adaptive(&ctx, values, GENMC_CAPACITY);
+        for (size_t j = 0; j < n; j++)
+            mark(values[j]);
+    }
+    consumer_ctx_fini(&ctx);
+    return NULL;
+}
+#endif
+
+// Lossy producer: drop the oldest item until there is room
+static void
+drop_oldest(void)
+{
+    void *value;
+
+    if (try_pop(queue, &value))
+        mark(value);
+}
+
+#if GENMC_CLIENT == 1
+static void
+produce(void)
+{
+    void *value;
+
+    for (uintptr_t i = 1; i <= GENMC_ITEMS; i++) {
+        if (i % 2 == 0) {
+            value = (void *)i;
+            while (try_push_many(queue, &value, 1) == 0)
+                drop_oldest();
+        } else {
+            while (!push_stage(queue, (void *)i))
+                drop_oldest();
+        }
+    }
+    push_flush(queue);
+}
+#else
+static void
+produce(void)
+{
+    for (uintptr_t i = 1; i <= GENMC_ITEMS; i++) {
+        while (!try_push(queue, (void *)i))
+            drop_oldest();
+    }
+}
+#endif
+
+int
+main(void)
+{
+    pthread_t c1, c2;
+    void *value;
+
+    queue = create_queue(GENMC_CAPACITY);
+    assert(queue != NULL);
+
+#if GENMC_CLIENT == 2
+    pthread_create(&c1, NULL, consumer_adaptive, NULL);
+    pthread_create(&c2, NULL, consumer_adaptive, NULL);
+#else
+    pthread_create(&c1, NULL, consumer_one, NULL);
+    pthread_create(&c2, NULL, consumer_many, NULL);
+#endif
+
+    produce();
+
+    pthread_join(c1, NULL);
+    pthread_join(c2, NULL);
+
+    while (try_pop(queue, &value))
+        mark(value);
+    for (int i = 1; i <= GENMC_ITEMS; i++)
+        assert(atomic_load_explicit(&seen[i], memory_order_relaxed) == 1);
+
+    destroy_queue(queue);
+    return 0;
+}
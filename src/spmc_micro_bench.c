@@ -0,0 +1,537 @@
+#include <float.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "SPMCQueue.h"
+
+/*
+ * Per-API microbenchmark.
+ *
+ * Every public push/pop function is timed in isolation, uncontended
+ * (single thread, queue pre-filled or pre-drained outside of the timed
+ * region) and contended (a second thread hammering the other end of the
+ * queue), across capacities and batch sizes. Results are printed as one
+ * line per case:
+ *
+ *     <case> <ns/op> <cycles/op>
+ *
+ * where "op" is one API call. The same format is used for the baseline
+ * file: with -b, uncontended cases that got slower than the baseline by
+ * more than the tolerance are reported and the exit code is non-zero.
+ * Contended cases are reported but not gated, as they depend on the core
+ * topology of the host far more than on the code.
+ */
+
+#define DEF_ROUNDS 2000
+#define DEF_TOLERANCE 25.0
+#define MAX_CASES 256
+#define MAX_BATCH 64
+#define CONT_CAPACITY 4096
+#define CONT_ITEMS (1 << 20)
+
+static const size_t capacities[] = {64, 4096};
+static const size_t batches[] = {1, 4, 16, 64};
+
+struct result {
+    char name[96];
+    double ns;
+    double cycles;
+    bool gated;
+};
+
+static struct result results[MAX_CASES];
+static int nresults;
+
+static void* values[CONT_CAPACITY];
+static void* scratch[CONT_CAPACITY];
+
+static inline uint64_t
+now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static inline uint64_t
+now_cycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#elif defined(__aarch64__)
+    uint64_t v;
+
+    __asm__ volatile("mrs %0, cntvct_el0" : "=r"(v));
+    return v;
+#else
+    return 0;
+#endif
+}
+
+// Best (lowest) per-op cost seen over the rounds of one case; the minimum
+// filters out preemptions and interrupts that land in a timed region.
+struct sample {
+    double ns;
+    double cycles;
+};
+
+#define SAMPLE_INIT {.ns = DBL_MAX, .cycles = DBL_MAX}
+#define SAMPLE_START(s) \
+    uint64_t _ns0 = now_ns(), _cy0 = now_cycles()
+#define SAMPLE_END(s, n) \
+    sample_update((s), now_ns() - _ns0, now_cycles() - _cy0, (n))
+
+// Cost of an empty SAMPLE_START/SAMPLE_END pair, subtracted from results
+static uint64_t overhead_ns, overhead_cycles;
+
+static void
+sample_update(struct sample *s, uint64_t ns, uint64_t cycles, uint64_t ops)
+{
+    double ns_op, cycles_op;
+
+    ns = (ns > overhead_ns) ? ns - overhead_ns : 0;
+    cycles = (cycles > overhead_cycles) ? cycles - overhead_cycles : 0;
+    ns_op = (double)ns / (double)(ops ? ops : 1);
+    cycles_op = (double)cycles / (double)(ops ? ops : 1);
+    if (ns_op < s->ns) {
+        s->ns = ns_op;
+        s->cycles = cycles_op;
+    }
+}
+
+static void
+calibrate(void)
+{
+    struct sample s = SAMPLE_INIT;
+
+    for (int i = 0; i < 1000; i++) {
+        SAMPLE_START(&s);
+        SAMPLE_END(&s, 1);
+    }
+    overhead_ns = (uint64_t)s.ns;
+    overhead_cycles = (uint64_t)s.cycles;
+}
+
+static void
+add_result(const char *name, const struct sample *s, bool gated)
+{
+    struct result *r;
+
+    if (nresults == MAX_CASES) {
+        fprintf(stderr, "Too many cases\n");
+        exit(EXIT_FAILURE);
+    }
+    r = &results[nresults++];
+    snprintf(r->name, sizeof(r->name), "%s", name);
+    r->ns = s->ns;
+    r->cycles = s->cycles;
+    r->gated = gated;
+    printf("%-48s %10.2f %10.2f\n", r->name, r->ns, r->cycles);
+    fflush(stdout);
+}
+
+static void
+nop_pre_push(void *cb_arg, void *value)
+{
+    (void)cb_arg;
+    (void)value;
+}
+
+static void *
+identity_value(void *cb_arg, void *key)
+{
+    (void)cb_arg;
+    return key;
+}
+
+static void
+fill(SPMCQueue* queue, size_t capacity)
+{
+    size_t left = capacity;
+
+    while (left > 0)
+        left -= try_push_many(queue, values, left);
+}
+
+static void
+drain(SPMCQueue* queue, size_t capacity)
+{
+    while (try_pop_many(queue, scratch, capacity) > 0)
+        continue;
+}
+
+enum push_api { PUSH_ONE, PUSH_MANY, PUSH_MANY_PRE, PUSH_MANY_KV, PUSH_STAGE };
+enum pop_api { POP_ONE, POP_MANY, POP_SEQ, POP_MANY_SEQ, POP_ADAPTIVE };
+
+static const char *push_names[] = {
+    "try_push", "try_push_many", "try_push_many_pre", "try_push_many_kv",
+    "push_stage+flush",
+};
+static const char *pop_names[] = {
+    "try_pop", "try_pop_many", "try_pop_seq", "try_pop_many_seq",
+    "pop_adaptive",
+};
+
+static inline size_t
+do_push(SPMCQueue* queue, enum push_api api, void** v, size_t batch)
+{
+    switch (api) {
+    case PUSH_ONE:
+        return try_push(queue, v[0]) ? 1 : 0;
+    case PUSH_MANY:
+        return try_push_many(queue, v, batch);
+    case PUSH_MANY_PRE:
+        return try_push_many_pre(queue, v, batch, nop_pre_push, NULL);
+    case PUSH_MANY_KV:
+        return try_push_many_kv(queue, v, batch, identity_value, NULL);
+    default:
+        for (size_t i = 0; i < batch; i++) {
+            if (!push_stage(queue, v[i]))
+                break;
+        }
+        return push_flush(queue);
+    }
+}
+
+static inline size_t
+do_pop(SPMCQueue* queue, consumer_ctx* ctx, enum pop_api api, void** v,
+  size_t batch)
+{
+    uint64_t seq;
+
+    switch (api) {
+    case POP_ONE:
+        return try_pop(queue, v) ? 1 : 0;
+    case POP_MANY:
+        return try_pop_many(queue, v, batch);
+    case POP_SEQ:
+        return try_pop_seq(queue, v, &seq) ? 1 : 0;
+    case POP_MANY_SEQ:
+        return try_pop_many_seq(queue, v, batch, &seq);
+    default:
+        return pop_adaptive(ctx, v, batch);
+    }
+}
+
+// Small queues are timed in groups so that every timed region covers
+// CONT_CAPACITY slots worth of operations, well above timer resolution.
+#define NQUEUES(capacity) \
+    (((capacity) < CONT_CAPACITY) ? CONT_CAPACITY / (capacity) : 1)
+
+static void
+bench_push_uncontended(enum push_api api, size_t capacity, size_t batch,
+  int rounds)
+{
+    SPMCQueue* queues[CONT_CAPACITY];
+    struct sample s = SAMPLE_INIT;
+    char name[96];
+    size_t calls = capacity / batch, nq = NQUEUES(capacity);
+
+    for (size_t q = 0; q < nq; q++)
+        queues[q] = create_queue(capacity);
+    for (int r = 0; r < rounds; r++) {
+        SAMPLE_START(&s);
+        for (size_t q = 0; q < nq; q++) {
+            for (size_t i = 0; i < calls; i++)
+                do_push(queues[q], api, values + i * batch, batch);
+        }
+        SAMPLE_END(&s, calls * nq);
+        for (size_t q = 0; q < nq; q++)
+            drain(queues[q], capacity);
+    }
+    snprintf(name, sizeof(name), "%s/cap=%zu/batch=%zu/uncontended",
+      push_names[api], capacity, batch);
+    add_result(name, &s, true);
+    for (size_t q = 0; q < nq; q++)
+        destroy_queue(queues[q]);
+}
+
+static void
+bench_pop_uncontended(enum pop_api api, size_t capacity, size_t batch,
+  int rounds)
+{
+    SPMCQueue* queues[CONT_CAPACITY];
+    consumer_ctx ctxs[CONT_CAPACITY];
+    struct sample s = SAMPLE_INIT;
+    char name[96];
+    size_t calls = capacity / batch, nq = NQUEUES(capacity);
+
+    for (size_t q = 0; q < nq; q++) {
+        queues[q] = create_queue(capacity);
+        consumer_ctx_init(&ctxs[q], queues[q]);
+    }
+    for (int r = 0; r < rounds; r++) {
+        for (size_t q = 0; q < nq; q++)
+            fill(queues[q], capacity);
+        SAMPLE_START(&s);
+        for (size_t q = 0; q < nq; q++) {
+            for (size_t i = 0; i < calls; i++)
+                do_pop(queues[q], &ctxs[q], api, scratch + i * batch, batch);
+        }
+        SAMPLE_END(&s, calls * nq);
+    }
+    snprintf(name, sizeof(name), "%s/cap=%zu/batch=%zu/uncontended",
+      pop_names[api], capacity, batch);
+    add_result(name, &s, true);
+    for (size_t q = 0; q < nq; q++) {
+        consumer_ctx_fini(&ctxs[q]);
+        destroy_queue(queues[q]);
+    }
+}
+
+struct peer_args {
+    SPMCQueue* queue;
+    _Atomic bool stop;
+};
+
+static void*
+draining_peer(void* arg)
+{
+    struct peer_args* pa = arg;
+    void* v[8];
+
+    while (!atomic_load_explicit(&pa->stop, memory_order_relaxed))
+        try_pop_many(pa->queue, v, 8);
+    return NULL;
+}
+
+static void*
+popping_peer(void* arg)
+{
+    struct peer_args* pa = arg;
+    consumer_ctx ctx;
+    void* v;
+
+    // Registered, so that pop_adaptive() sees two active consumers
+    consumer_ctx_init(&ctx, pa->queue);
+    while (!atomic_load_explicit(&pa->stop, memory_order_relaxed))
+        try_pop(pa->queue, &v);
+    consumer_ctx_fini(&ctx);
+    return NULL;
+}
+
+// Producer pushes while a consumer drains the other end
+static void
+bench_push_contended(enum push_api api, size_t batch)
+{
+    struct peer_args pa = {.queue = create_queue(CONT_CAPACITY)};
+    struct sample s = SAMPLE_INIT;
+    pthread_t peer;
+    char name[96];
+    uint64_t calls = 0;
+
+    atomic_init(&pa.stop, false);
+    pthread_create(&peer, NULL, draining_peer, &pa);
+    SAMPLE_START(&s);
+    for (size_t pushed = 0; pushed < CONT_ITEMS; calls++)
+        pushed += do_push(pa.queue, api, values, batch);
+    SAMPLE_END(&s, calls);
+    atomic_store(&pa.stop, true);
+    pthread_join(peer, NULL);
+    snprintf(name, sizeof(name), "%s/cap=%d/batch=%zu/contended",
+      push_names[api], CONT_CAPACITY, batch);
+    add_result(name, &s, false);
+    destroy_queue(pa.queue);
+}
+
+// Consumer pops while another consumer races it for readIdx. The queue is
+// refilled outside of the timed region, which then runs until this
+// consumer finds the queue empty (that last empty pop is counted too).
+static void
+bench_pop_contended(enum pop_api api, size_t batch)
+{
+    struct peer_args pa = {.queue = create_queue(CONT_CAPACITY)};
+    struct sample s = SAMPLE_INIT;
+    consumer_ctx ctx;
+    pthread_t peer;
+    char name[96];
+    uint64_t calls = 0, ns = 0, cycles = 0;
+
+    atomic_init(&pa.stop, false);
+    consumer_ctx_init(&ctx, pa.queue);
+    pthread_create(&peer, NULL, popping_peer, &pa);
+    for (size_t popped = 0; popped < CONT_ITEMS;) {
+        uint64_t ns0, cy0;
+        size_t n;
+
+        fill(pa.queue, CONT_CAPACITY);
+        ns0 = now_ns();
+        cy0 = now_cycles();
+        do {
+            n = do_pop(pa.queue, &ctx, api, scratch, batch);
+            popped += n;
+            calls++;
+        } while (n > 0);
+        ns += now_ns() - ns0;
+        cycles += now_cycles() - cy0;
+    }
+    sample_update(&s, ns, cycles, calls);
+    atomic_store(&pa.stop, true);
+    pthread_join(peer, NULL);
+    consumer_ctx_fini(&ctx);
+    snprintf(name, sizeof(name), "%s/cap=%d/batch=%zu/contended",
+      pop_names[api], CONT_CAPACITY, batch);
+    add_result(name, &s, false);
+    destroy_queue(pa.queue);
+}
+
+static int
+check_baseline(const char *path, double tolerance)
+{
+    FILE *f = fopen(path, "r");
+    char line[256], name[96];
+    double ns;
+    int regressions = 0, compared = 0, missing = 0;
+
+    if (f == NULL) {
+        perror(path);
+        return -1;
+    }
+    while (fgets(line, sizeof(line), f) != NULL) {
+        struct result *r;
+        double change;
+        int i;
+
+        if (line[0] == '#' || sscanf(line, "%95s %lf", name, &ns) != 2)
+            continue;
+        for (i = 0; i < nresults; i++) {
+            if (results[i].gated && strcmp(results[i].name, name) == 0)
+                break;
+        }
+        if (i == nresults) {
+            // A renamed or dropped case must not pass silently
+            printf("MISSING    %-37s %10.2f ns/op\n", name, ns);
+            missing += 1;
+            continue;
+        }
+        r = &results[i];
+        change = (r->ns / ns - 1.0) * 100.0;
+        compared += 1;
+        if (change > tolerance) {
+            printf("REGRESSION %-37s %10.2f -> %.2f ns/op (%+.1f%%)\n",
+              name, ns, r->ns, change);
+            regressions += 1;
+        }
+    }
+    fclose(f);
+    if (compared == 0) {
+        fprintf(stderr, "%s: no cases to compare against\n", path);
+        return -1;
+    }
+    printf("%d of %d cases regressed by more than %.1f%%, %d missing, "
+      "against %s\n", regressions, compared, tolerance, missing, path);
+    return regressions + missing;
+}
+
+static int
+write_results(const char *path)
+{
+    FILE *f = fopen(path, "w");
+
+    if (f == NULL) {
+        perror(path);
+        return -1;
+    }
+    fprintf(f, "# spmc_micro_bench results: <case> <ns/op> <cycles/op>\n");
+    for (int i = 0; i < nresults; i++) {
+        if (results[i].gated)
+            fprintf(f, "%s %.2f %.2f\n", results[i].name, results[i].ns,
+              results[i].cycles);
+    }
+    fclose(f);
+    return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+    const char *baseline = NULL, *output = NULL;
+    double tolerance = DEF_TOLERANCE;
+    int rounds = DEF_ROUNDS;
+    bool contended = true;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "b:o:r:T:u")) != -1) {
+        switch (opt) {
+        case 'b':
+            baseline = optarg;
+            break;
+        case 'o':
+            output = optarg;
+            break;
+        case 'r':
+            rounds = atoi(optarg);
+            break;
+        case 'T':
+            tolerance = atof(optarg);
+            break;
+        case 'u':
+            contended = false;
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-r rounds] [-u] [-o results_file] "
+              "[-b baseline_file [-T tolerance_pct]]\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (rounds <= 0) {
+        fprintf(stderr, "Number of rounds must be greater than 0\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (size_t i = 0; i < CONT_CAPACITY; i++)
+        values[i] = (void*)(uintptr_t)(i + 1);
+    calibrate();
+
+    printf("%-48s %10s %10s\n", "# case", "ns/op", "cycles/op");
+    for (size_t c = 0; c < sizeof(capacities) / sizeof(capacities[0]); c++) {
+        size_t cap = capacities[c];
+
+        bench_push_uncontended(PUSH_ONE, cap, 1, rounds);
+        bench_pop_uncontended(POP_ONE, cap, 1, rounds);
+        bench_pop_uncontended(POP_SEQ, cap, 1, rounds);
+        for (size_t b = 0; b < sizeof(batches) / sizeof(batches[0]); b++) {
+            size_t batch = batches[b];
+
+            bench_push_uncontended(PUSH_MANY, cap, batch, rounds);
+            bench_push_uncontended(PUSH_MANY_PRE, cap, batch, rounds);
+            bench_push_uncontended(PUSH_MANY_KV, cap, batch, rounds);
+            bench_push_uncontended(PUSH_STAGE, cap, batch, rounds);
+            bench_pop_uncontended(POP_MANY, cap, batch, rounds);
+            bench_pop_uncontended(POP_MANY_SEQ, cap, batch, rounds);
+            bench_pop_uncontended(POP_ADAPTIVE, cap, batch, rounds);
+        }
+    }
+    if (contended) {
+        bench_push_contended(PUSH_ONE, 1);
+        bench_pop_contended(POP_ONE, 1);
+        for (size_t b = 0; b < sizeof(batches) / sizeof(batches[0]); b++) {
+            bench_push_contended(PUSH_MANY, batches[b]);
+            bench_push_contended(PUSH_STAGE, batches[b]);
+            bench_pop_contended(POP_MANY, batches[b]);
+            bench_pop_contended(POP_ADAPTIVE, batches[b]);
+        }
+    }
+
+    if (output != NULL && write_results(output) != 0)
+        return 2;
+    if (baseline != NULL) {
+        int regressions = check_baseline(baseline, tolerance);
+
+        if (regressions != 0)
+            return (regressions < 0) ? 2 : 1;
+    }
+    return 0;
+}
@@ -0,0 +1,260 @@
+#include <assert.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "SPMCQueue.h"
+#include "SPMCPartQueue.h"
+
+#define NKEYS 32
+#define NITEMS 100000
+#define NCONSUMERS 3
+#define MAX_BATCH 16
+
+struct item {
+    uint32_t key;
+    uint32_t seq;
+};
+
+static uint64_t
+item_hash(void *cb_arg, void *key)
+{
+    (void)cb_arg;
+    return ((struct item*)key)->key;
+}
+
+static void *
+item_value(void *cb_arg, void *key)
+{
+    (void)cb_arg;
+    // Lets the test check that rejected keys are skipped
+    if (((struct item*)key)->seq == UINT32_MAX)
+        return NULL;
+    return key;
+}
+
+static void
+test_routing(void)
+{
+    SPMCPartQueue* pqueue = create_part_queue(4, 2, 2, 0);
+    struct item items[8] = {{0, 0}, {1, 0}, {0, 1}, {0, 2}, {1, 1}};
+    void* keys[8];
+    void* values[8];
+    size_t n;
+
+    assert(pqueue != NULL);
+    for (int i = 0; i < 8; i++) {
+        keys[i] = &items[i];
+    }
+    // Partition 0 fills up after two keys: later keys must not overtake
+    n = part_push_many_kv(pqueue, keys, 5, item_hash, item_value, NULL);
+    assert(n == 3);
+    n = part_push_many_kv(pqueue, keys + 3, 2, item_hash, item_value, NULL);
+    assert(n == 0);
+
+    // Consumer 0 owns partitions 0 and 2, a batch never mixes partitions
+    n = part_pop_many(pqueue, 0, values, 8);
+    assert(n == 2);
+    assert(values[0] == &items[0] && values[1] == &items[2]);
+    // Consumer 1 owns partition 1
+    n = part_pop_many(pqueue, 1, values, 8);
+    assert(n == 1);
+    assert(values[0] == &items[1]);
+    n = part_push_many_kv(pqueue, keys + 3, 2, item_hash, item_value, NULL);
+    assert(n == 2);
+
+    // Partition 1 is still held by consumer 1: nothing to steal for 0,
+    // which serves its own partition 0
+    n = part_pop_many(pqueue, 0, values, 8);
+    assert(n == 1);
+    assert(values[0] == &items[3]);
+    n = part_pop_many(pqueue, 0, values, 8);
+    assert(n == 0);
+    // Once consumer 1 lets go, consumer 0 steals the whole partition
+    part_pop_done(pqueue, 1);
+    n = part_pop_many(pqueue, 0, values, 8);
+    assert(n == 1);
+    assert(values[0] == &items[4]);
+    n = part_pop_many(pqueue, 1, values, 8);
+    assert(n == 0);
+    items[5] = (struct item){1, 2};
+    n = part_push_many_kv(pqueue, keys + 5, 1, item_hash, item_value, NULL);
+    assert(n == 1);
+    // ...and keeps it: consumer 1 no longer owns partition 1 but may steal
+    // it back when idle and the partition is not held
+    n = part_pop_many(pqueue, 1, values, 8);
+    assert(n == 0);
+    part_pop_done(pqueue, 0);
+    n = part_pop_many(pqueue, 1, values, 8);
+    assert(n == 1);
+    assert(values[0] == &items[5]);
+
+    // Keys get_value() rejects are consumed but not queued
+    items[6] = (struct item){2, UINT32_MAX};
+    n = part_push_many_kv(pqueue, keys + 6, 1, item_hash, item_value, NULL);
+    assert(n == 1);
+    part_pop_done(pqueue, 1);
+    n = part_pop_many(pqueue, 0, values, 8);
+    assert(n == 0);
+    n = part_pop_many(pqueue, 1, values, 8);
+    assert(n == 0);
+
+    destroy_part_queue(pqueue);
+}
+
+static uint64_t
+counting_hash(void *cb_arg, void *key)
+{
+    *(int*)cb_arg += 1;
+    return ((struct item*)key)->key;
+}
+
+static void
+test_hash_once(void)
+{
+    SPMCPartQueue* pqueue = create_part_queue(4, 2, 2, 0);
+    struct item items[5] = {{0, 0}, {1, 0}, {0, 1}, {0, 2}, {1, 1}};
+    void* keys[5];
+    int calls = 0;
+    size_t n;
+
+    assert(pqueue != NULL);
+    for (int i = 0; i < 5; i++) {
+        keys[i] = &items[i];
+    }
+    // Each key is hashed once, including those that end a run
+    n = part_push_many_kv(pqueue, keys, 2, counting_hash, item_value,
+      &calls);
+    assert(n == 2 && calls == 2);
+    calls = 0;
+    // Partition 0 fills up after one more key, the rest stay unpushed
+    n = part_push_many_kv(pqueue, keys + 2, 3, counting_hash, item_value,
+      &calls);
+    assert(n == 1 && calls == 3);
+    destroy_part_queue(pqueue);
+}
+
+struct consumer_args {
+    SPMCPartQueue* pqueue;
+    unsigned int id;
+    _Atomic uint32_t* last_seq;
+    _Atomic bool* done;
+    uint64_t count;
+};
+
+static void*
+consumer_thread(void* arg)
+{
+    struct consumer_args* ca = arg;
+    void* values[MAX_BATCH];
+    unsigned int seed = ca->id + 1;
+
+    for (;;) {
+        bool done = atomic_load_explicit(ca->done, memory_order_acquire);
+        size_t n = part_pop_many(ca->pqueue, ca->id, values,
+          1 + rand_r(&seed) % MAX_BATCH);
+
+        if (n == 0 && done) {
+            break;
+        }
+        for (size_t i = 0; i < n; i++) {
+            struct item* it = values[i];
+
+            // Per-key order holds across consumers and steals
+            assert(it->seq == atomic_load_explicit(&ca->last_seq[it->key],
+              memory_order_relaxed));
+            atomic_store_explicit(&ca->last_seq[it->key], it->seq + 1,
+              memory_order_relaxed);
+        }
+        ca->count += n;
+        // Consumer 0 is slow, so the others steal its partitions
+        if (ca->id == 0 && n > 0 && rand_r(&seed) % 64 == 0) {
+            usleep(500);
+        }
+    }
+    part_pop_done(ca->pqueue, ca->id);
+    return NULL;
+}
+
+static void
+test_concurrent(void)
+{
+    SPMCPartQueue* pqueue = create_part_queue(8, 64, NCONSUMERS, 0);
+    struct item* items = malloc(NITEMS * sizeof(items[0]));
+    uint32_t next_seq[NKEYS] = {0};
+    _Atomic uint32_t last_seq[NKEYS];
+    struct consumer_args ca[NCONSUMERS];
+    pthread_t threads[NCONSUMERS];
+    _Atomic bool done;
+    uint64_t total = 0;
+    unsigned int seed = 42;
+
+    assert(pqueue != NULL && items != NULL);
+    for (int i = 0; i < NKEYS; i++) {
+        atomic_init(&last_seq[i], 0);
+    }
+    for (size_t i = 0; i < NITEMS; i++) {
+        uint32_t key = (uint32_t)(rand_r(&seed) % NKEYS);
+
+        items[i] = (struct item){key, next_seq[key]++};
+    }
+    atomic_init(&done, false);
+    for (unsigned int i = 0; i < NCONSUMERS; i++) {
+        ca[i] = (struct consumer_args){.pqueue = pqueue, .id = i,
+          .last_seq = last_seq, .done = &done};
+        if (pthread_create(&threads[i], NULL, consumer_thread, &ca[i])) {
+            fprintf(stderr, "Error creating thread\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (size_t i = 0; i < NITEMS;) {
+        void* keys[MAX_BATCH];
+        size_t n = 1 + (size_t)rand_r(&seed) % MAX_BATCH;
+
+        if (n > NITEMS - i) {
+            n = NITEMS - i;
+        }
+        for (size_t j = 0; j < n; j++) {
+            keys[j] = &items[i + j];
+        }
+        n = part_push_many_kv(pqueue, keys, n, item_hash, item_value, NULL);
+        if (n == 0) {
+            sched_yield();
+        }
+        i += n;
+    }
+    atomic_store_explicit(&done, true, memory_order_release);
+    for (int i = 0; i < NCONSUMERS; i++) {
+        if (pthread_join(threads[i], NULL)) {
+            fprintf(stderr, "Error joining thread\n");
+            exit(EXIT_FAILURE);
+        }
+        total += ca[i].count;
+    }
+    assert(total == NITEMS);
+    for (int i = 0; i < NKEYS; i++) {
+        assert(atomic_load(&last_seq[i]) == next_seq[i]);
+    }
+    printf("part: %d items, per consumer:", NITEMS);
+    for (int i = 0; i < NCONSUMERS; i++) {
+        printf(" %llu", (unsigned long long)ca[i].count);
+    }
+    printf("\n");
+    free(items);
+    destroy_part_queue(pqueue);
+}
+
+int
+main(void)
+{
+    test_routing();
+    test_hash_once();
+    test_concurrent();
+    return 0;
+}
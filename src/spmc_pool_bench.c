@@ -0,0 +1,203 @@
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "SPMCQueue.h"
+#include "SPMCBufPool.h"
+
+/*
+ * Message buffer recycling benchmark: a producer allocates a buffer per
+ * message, fills it and pushes it (lossy) to several consumers, which read
+ * it and release it. The buffers either come from malloc()/free() or from
+ * an SPMCBufPool. To compare against another allocator, e.g. jemalloc,
+ * run the malloc mode with it preloaded:
+ *
+ *     LD_PRELOAD=libjemalloc.so.2 ./spmc_pool_bench -m malloc
+ */
+
+#define NUM_SECONDS 3
+#define QUEUE_SIZE 4096
+#define BUF_SIZE 256
+#define MAX_CONSUMERS 16
+#define WRKR_BATCH_SIZE 8
+
+enum mode { MODE_MALLOC, MODE_POOL };
+
+struct bench {
+    SPMCQueue* queue;
+    SPMCBufPool* pool;
+    enum mode mode;
+    size_t bufsize;
+    _Atomic bool done;
+};
+
+struct consumer_args {
+    struct bench* b;
+    uint64_t count;
+    uint64_t chksum;
+};
+
+static inline void
+release_buf(struct bench* b, void* buf)
+{
+    if (b->mode == MODE_POOL)
+        bufpool_put(b->pool, buf);
+    else
+        free(buf);
+}
+
+static void*
+consumer_thread(void* arg)
+{
+    struct consumer_args* ca = arg;
+    struct bench* b = ca->b;
+    void* values[WRKR_BATCH_SIZE];
+
+    for (;;) {
+        bool done = atomic_load_explicit(&b->done, memory_order_acquire);
+        size_t n = try_pop_many(b->queue, values, WRKR_BATCH_SIZE);
+
+        if (n == 0 && done)
+            break;
+        for (size_t i = 0; i < n; i++) {
+            ca->chksum += *(uint64_t*)values[i];
+            release_buf(b, values[i]);
+        }
+        ca->count += n;
+    }
+    return NULL;
+}
+
+static double
+now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void
+run(enum mode mode, int nconsumers, int seconds, size_t bufsize)
+{
+    struct bench b = {.mode = mode, .bufsize = bufsize};
+    struct consumer_args ca[MAX_CONSUMERS] = {{0}};
+    pthread_t workers[MAX_CONSUMERS];
+    uint64_t sent = 0, dropped = 0, stalls = 0, received = 0;
+    double stime, etime;
+    void* junk;
+
+    b.queue = create_queue(QUEUE_SIZE);
+    if (mode == MODE_POOL) {
+        // Enough buffers for a full queue plus what consumers hold
+        b.pool = create_bufpool(bufsize,
+          QUEUE_SIZE + (size_t)nconsumers * WRKR_BATCH_SIZE * 2);
+    }
+    if (b.queue == NULL || (mode == MODE_POOL && b.pool == NULL)) {
+        fprintf(stderr, "Error creating queue/pool\n");
+        exit(EXIT_FAILURE);
+    }
+    atomic_init(&b.done, false);
+    for (int i = 0; i < nconsumers; i++) {
+        ca[i].b = &b;
+        if (pthread_create(&workers[i], NULL, consumer_thread, &ca[i])) {
+            fprintf(stderr, "Error creating thread\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    stime = now();
+    etime = stime + seconds;
+    for (uint64_t i = 1;; i++) {
+        void* buf;
+
+        if (mode == MODE_POOL) {
+            while ((buf = bufpool_get(b.pool)) == NULL)
+                stalls++;
+        } else {
+            buf = malloc(bufsize);
+        }
+        memset(buf, 0, bufsize);
+        *(uint64_t*)buf = i;
+        if (mode == MODE_POOL) {
+            dropped += bufpool_push_lossy(b.pool, b.queue, buf);
+        } else {
+            while (!try_push(b.queue, buf)) {
+                if (try_pop(b.queue, &junk)) {
+                    free(junk);
+                    dropped++;
+                }
+            }
+        }
+        sent++;
+        if ((i & 0xffff) == 0 && now() >= etime)
+            break;
+    }
+    etime = now();
+
+    atomic_store_explicit(&b.done, true, memory_order_release);
+    for (int i = 0; i < nconsumers; i++) {
+        pthread_join(workers[i], NULL);
+        received += ca[i].count;
+    }
+    while (try_pop(b.queue, &junk))
+        release_buf(&b, junk);
+
+    printf("%-6s consumers=%d bufsize=%zu: %.3f Mmsg/s sent, %" PRIu64
+      " received, %" PRIu64 " dropped, %" PRIu64 " pool stalls\n",
+      mode == MODE_POOL ? "pool" : "malloc", nconsumers, bufsize,
+      1e-6 * (double)sent / (etime - stime), received, dropped, stalls);
+
+    destroy_queue(b.queue);
+    if (b.pool != NULL)
+        destroy_bufpool(b.pool);
+}
+
+int
+main(int argc, char *argv[])
+{
+    int seconds = NUM_SECONDS, nconsumers = 2, opt;
+    size_t bufsize = BUF_SIZE;
+    bool do_malloc = true, do_pool = true;
+
+    while ((opt = getopt(argc, argv, "t:c:s:m:")) != -1) {
+        switch (opt) {
+        case 't':
+            seconds = atoi(optarg);
+            break;
+        case 'c':
+            nconsumers = atoi(optarg);
+            break;
+        case 's':
+            bufsize = (size_t)strtoul(optarg, NULL, 0);
+            break;
+        case 'm':
+            do_malloc = strcmp(optarg, "malloc") == 0;
+            do_pool = strcmp(optarg, "pool") == 0;
+            break;
+        default:
+            goto usage;
+        }
+    }
+    if (seconds <= 0 || nconsumers <= 0 || nconsumers > MAX_CONSUMERS ||
+      bufsize < sizeof(uint64_t) || (!do_malloc && !do_pool))
+        goto usage;
+
+    if (do_malloc)
+        run(MODE_MALLOC, nconsumers, seconds, bufsize);
+    if (do_pool)
+        run(MODE_POOL, nconsumers, seconds, bufsize);
+    return 0;
+
+usage:
+    fprintf(stderr, "Usage: %s [-t num_seconds] [-c consumers] [-s bufsize] "
+      "[-m malloc|pool]\n", argv[0]);
+    return 1;
+}
@@ -182,6 +182,237 @@ test_try_push_many_kv_stops_at_capacity(void)
     destroy_queue(queue);
 }
 
+static void
+test_swizzled_layout_wrap(void)
+{
+    SPMCQueue* queue = create_queue_ex(16, SPMC_SLOTS_SWIZZLED);
+    void* values[16];
+    void* keys[] = {(void*)30, (void*)31, (void*)32};
+    struct pre_push_ctx pctx = {0};
+    struct kv_push_ctx kctx = {0};
+    void* value;
+
+    assert(queue != NULL);
+    for (uintptr_t i = 0; i < 16; i++) {
+        values[i] = (void*)(i + 1);
+    }
+    assert(try_push_many(queue, values, 16) == 16);
+    assert(!try_push(queue, (void*)17));
+    expect_pop_many(queue, 1, 11);
+
+    // Wraps around the ring
+    for (uintptr_t i = 0; i < 8; i++) {
+        values[i] = (void*)(i + 17);
+    }
+    assert(try_push_many(queue, values, 8) == 8);
+    assert(try_push_many_pre(queue, values, 3, record_pre_push, &pctx) == 3);
+    assert(try_push_many(queue, values, 1) == 0);
+    expect_pop_many(queue, 12, 13);
+    expect_pop_many(queue, 17, 3);
+
+    assert(try_push_many_kv(queue, keys, 3, get_even_value, &kctx) == 3);
+    assert(try_push(queue, (void*)99));
+    assert(try_pop(queue, &value) && (uintptr_t)value == 130);
+    assert(try_pop_many(queue, values, 16) == 2);
+    assert((uintptr_t)values[0] == 132 && (uintptr_t)values[1] == 99);
+    assert(!try_pop(queue, &value));
+    destroy_queue(queue);
+}
+
+static void
+test_swizzled_layout_small_capacity(void)
+{
+    // Too small to spread over lines, falls back to the dense layout
+    SPMCQueue* queue = create_queue_ex(4, SPMC_SLOTS_SWIZZLED);
+    void* values[] = {(void*)1, (void*)2, (void*)3, (void*)4};
+
+    assert(queue != NULL);
+    assert(try_push_many(queue, values, 4) == 4);
+    expect_pop_many(queue, 1, 4);
+    destroy_queue(queue);
+}
+
+static void
+test_try_pop_seq_reports_gaps(void)
+{
+    SPMCQueue* queue = create_queue(4);
+    void* values[] = {(void*)1, (void*)2, (void*)3, (void*)4};
+    void* out[4];
+    void* value;
+    uint64_t seq = 0;
+
+    assert(queue != NULL);
+    assert(!try_pop_seq(queue, &value, &seq));
+    assert(try_pop_many_seq(queue, out, 4, &seq) == 0);
+
+    assert(try_push_many(queue, values, 4) == 4);
+    assert(try_pop_seq(queue, &value, &seq));
+    assert((uintptr_t)value == 1 && seq == 0);
+
+    // Lossy producer drops the oldest item to make room
+    assert(try_push(queue, (void*)5));
+    assert(!try_push(queue, (void*)6));
+    assert(try_pop(queue, &value) && (uintptr_t)value == 2);
+    assert(try_push(queue, (void*)6));
+
+    // The consumer sees sequence 2 after 0: one item missed
+    size_t n = try_pop_many_seq(queue, out, 4, &seq);
+    assert(n > 0 && seq == 2 && (uintptr_t)out[0] == 3);
+    if (n < 4) {
+        // Popping stops at the cached writeIdx, the rest follows contiguously
+        assert(try_pop_many_seq(queue, out + n, 4 - n, &seq) == 4 - n);
+        assert(seq == 2 + n);
+    }
+    assert((uintptr_t)out[3] == 6);
+
+    // Sequence numbers keep counting across wrap-around
+    assert(try_push_many(queue, values, 4) == 4);
+    assert(try_pop_many_seq(queue, out, 2, &seq) == 2 && seq == 6);
+    assert(try_pop_seq(queue, &value, &seq) && seq == 8);
+    assert((uintptr_t)value == 3);
+    destroy_queue(queue);
+}
+
+static void
+test_push_stage_flush(void)
+{
+    SPMCQueue* queue = create_queue(8);
+    void* value;
+
+    assert(queue != NULL);
+    assert(push_flush(queue) == 0);
+    assert(push_stage(queue, (void*)1));
+    assert(push_stage(queue, (void*)2));
+    // Staged items are not visible until published
+    assert(!try_pop(queue, &value));
+    assert(push_flush(queue) == 2);
+    assert(push_flush(queue) == 0);
+    expect_pop_many(queue, 1, 2);
+
+    // Any other push publishes the staged items ahead of its own
+    assert(push_stage(queue, (void*)3));
+    assert(try_push(queue, (void*)4));
+    expect_pop_many(queue, 3, 2);
+    destroy_queue(queue);
+}
+
+static void
+test_push_stage_auto_publish(void)
+{
+    SPMCQueue* queue = create_queue(4);
+    void* values[4];
+    void* value;
+
+    assert(queue != NULL);
+    set_push_stage_limit(queue, 2);
+    assert(push_stage(queue, (void*)1));
+    assert(!try_pop(queue, &value));
+    assert(push_stage(queue, (void*)2));
+    // Stage limit reached: published without push_flush()
+    expect_pop_many(queue, 1, 2);
+
+    // Ring fills up: pending items are published so consumers can drain
+    set_push_stage_limit(queue, 100);
+    for (uintptr_t i = 3; i <= 6; i++) {
+        assert(push_stage(queue, (void*)i));
+    }
+    assert(!push_stage(queue, (void*)7));
+    assert(try_pop_many(queue, values, 4) == 4);
+    assert((uintptr_t)values[0] == 3 && (uintptr_t)values[3] == 6);
+    assert(push_stage(queue, (void*)7));
+    assert(push_flush(queue) == 1);
+    assert(try_pop(queue, &value) && (uintptr_t)value == 7);
+    destroy_queue(queue);
+}
+
+static void
+test_push_stage_published_without_write(void)
+{
+    SPMCQueue* queue = create_queue(4);
+    void* first[] = {(void*)1, (void*)2, (void*)3};
+    void* keys[] = {(void*)1, (void*)3};
+    void* values[4];
+    struct pre_push_ctx pctx = {0};
+    struct kv_push_ctx kctx = {0};
+
+    assert(queue != NULL);
+    // Pushes that fail on a full queue still publish the staged items
+    assert(try_push_many(queue, first, 3) == 3);
+    assert(push_stage(queue, (void*)4));
+    assert(!try_push(queue, (void*)5));
+    expect_pop_many(queue, 1, 4);
+
+    assert(try_push_many(queue, first, 3) == 3);
+    assert(push_stage(queue, (void*)4));
+    assert(try_push_many(queue, first, 1) == 0);
+    expect_pop_many(queue, 1, 4);
+
+    assert(try_push_many(queue, first, 3) == 3);
+    assert(push_stage(queue, (void*)4));
+    assert(try_push_many_pre(queue, first, 1, record_pre_push, &pctx) == 0);
+    assert(pctx.count == 0);
+    expect_pop_many(queue, 1, 4);
+
+    // ...and so does a kv push whose keys are all filtered out
+    assert(push_stage(queue, (void*)7));
+    assert(try_push_many_kv(queue, keys, 2, get_even_value, &kctx) == 2);
+    assert(try_pop_many(queue, values, 4) == 1);
+    assert((uintptr_t)values[0] == 7);
+    assert(push_flush(queue) == 0);
+    destroy_queue(queue);
+}
+
+static void
+test_pop_adaptive_claims(void)
+{
+    SPMCQueue* queue = create_queue(64);
+    consumer_ctx ctx[4];
+    void* values[16];
+    uintptr_t next = 1;
+    size_t n;
+
+    assert(queue != NULL);
+    for (uintptr_t i = 1; i <= 40; i++) {
+        assert(try_push(queue, (void*)i));
+    }
+    consumer_ctx_init(&ctx[0], queue);
+    assert(pop_adaptive(&ctx[0], values, 16) == 16);
+    assert(ctx[0].batch == 16);
+    for (size_t i = 0; i < 16; i++) {
+        assert((uintptr_t)values[i] == next++);
+    }
+
+    // Four consumers share the remaining backlog of 24
+    for (int i = 1; i < 4; i++) {
+        consumer_ctx_init(&ctx[i], queue);
+    }
+    n = pop_adaptive(&ctx[1], values, 16);
+    assert(n == 6);
+    for (size_t i = 0; i < n; i++) {
+        assert((uintptr_t)values[i] == next++);
+    }
+    while ((n = pop_adaptive(&ctx[2], values, 16)) > 0) {
+        for (size_t i = 0; i < n; i++) {
+            assert((uintptr_t)values[i] == next++);
+        }
+    }
+    assert(next == 41 && ctx[2].batch == 1);
+
+    // Light load: single items are handed out one at a time
+    assert(try_push(queue, (void*)41) && try_push(queue, (void*)42));
+    assert(pop_adaptive(&ctx[3], values, 16) == 1);
+    assert((uintptr_t)values[0] == 41);
+    for (int i = 1; i < 4; i++) {
+        consumer_ctx_fini(&ctx[i]);
+    }
+    assert(pop_adaptive(&ctx[0], values, 16) == 1);
+    assert((uintptr_t)values[0] == 42);
+    assert(pop_adaptive(&ctx[0], values, 16) == 0);
+    assert(ctx[0].pops == 3 && ctx[0].cas_fails == 0);
+    consumer_ctx_fini(&ctx[0]);
+    destroy_queue(queue);
+}
+
 int
 main(void)
 {
@@ -192,5 +423,12 @@ main(void)
     test_try_push_many_pre_partial_when_full();
     test_try_push_many_kv_filters_and_consumes_all();
     test_try_push_many_kv_stops_at_capacity();
+    test_swizzled_layout_wrap();
+    test_swizzled_layout_small_capacity();
+    test_try_pop_seq_reports_gaps();
+    test_push_stage_flush();
+    test_push_stage_auto_publish();
+    test_push_stage_published_without_write();
+    test_pop_adaptive_claims();
     return 0;
 }
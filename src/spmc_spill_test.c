@@ -0,0 +1,251 @@
+#include <assert.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "SPMCQueue.h"
+#include "SPMCSpill.h"
+
+#define NCONSUMERS 3
+#define NITEMS 200000
+
+static char spill_path[256];
+
+static void
+make_spill_path(void)
+{
+    const char* dir = getenv("TMPDIR");
+
+    snprintf(spill_path, sizeof(spill_path), "%s/spmc_spill_test.%ld.bin",
+      dir != NULL ? dir : "/tmp", (long)getpid());
+}
+
+static void
+test_spill_order(void)
+{
+    SPMCQueue* queue = create_queue(4);
+    SPMCSpillQueue* squeue;
+    void* values[32];
+    void* value;
+    uintptr_t next = 6;
+    size_t n;
+    bool ok;
+
+    assert(queue != NULL);
+    squeue = create_spill_queue(queue, spill_path, 16 * sizeof(void*), 0,
+      NULL, NULL, NULL);
+    assert(squeue != NULL && access(spill_path, F_OK) == 0);
+
+    // 4 items fit in the ring, the next 16 in the spill, then it's lossy
+    for (uintptr_t i = 1; i <= 20; i++) {
+        ok = spill_push(squeue, (void*)i);
+        assert(ok);
+    }
+    assert(spill_pending(squeue) == 16);
+    ok = spill_push(squeue, (void*)21);
+    assert(!ok);
+
+    for (uintptr_t i = 1; i <= 4; i++) {
+        ok = spill_pop(squeue, &value);
+        assert(ok && (uintptr_t)value == i);
+    }
+    // The ring has room again, but the spill has to drain first
+    ok = spill_push(squeue, (void*)21);
+    assert(!ok);
+    ok = spill_pop(squeue, &value);
+    assert(ok && (uintptr_t)value == 5);
+    ok = spill_push(squeue, (void*)21);
+    assert(ok);
+    assert(spill_pending(squeue) == 16);
+
+    while ((n = spill_pop_many(squeue, values, 5)) > 0) {
+        for (size_t i = 0; i < n; i++) {
+            assert((uintptr_t)values[i] == next);
+            next++;
+        }
+    }
+    assert(next == 22 && spill_pending(squeue) == 0);
+
+    // Drained: back to the in-memory queue
+    ok = spill_push(squeue, (void*)22);
+    assert(ok);
+    assert(spill_pending(squeue) == 0);
+    ok = try_pop(queue, &value);
+    assert(ok && (uintptr_t)value == 22);
+
+    destroy_spill_queue(squeue);
+    assert(access(spill_path, F_OK) != 0);
+    destroy_queue(queue);
+}
+
+struct message {
+    uint32_t id;
+    char text[44];
+};
+
+static void
+encode_message(void *cb_arg, void *value, void *rec)
+{
+    (void)cb_arg;
+    memcpy(rec, value, sizeof(struct message));
+    free(value);
+}
+
+static void *
+decode_message(void *cb_arg, const void *rec)
+{
+    struct message* msg = malloc(sizeof(*msg));
+
+    (void)cb_arg;
+    assert(msg != NULL);
+    memcpy(msg, rec, sizeof(*msg));
+    return msg;
+}
+
+static void
+test_spill_encode(void)
+{
+    SPMCQueue* queue = create_queue(2);
+    SPMCSpillQueue* squeue;
+    void* values[8];
+    size_t n, total = 0;
+    bool ok;
+
+    assert(queue != NULL);
+    squeue = create_spill_queue(queue, spill_path,
+      8 * sizeof(struct message), sizeof(struct message), encode_message,
+      decode_message, NULL);
+    assert(squeue != NULL);
+    for (uint32_t i = 0; i < 10; i++) {
+        struct message* msg = malloc(sizeof(*msg));
+
+        assert(msg != NULL);
+        msg->id = i;
+        snprintf(msg->text, sizeof(msg->text), "message %u", i);
+        ok = spill_push(squeue, msg);
+        assert(ok);
+    }
+    assert(spill_pending(squeue) == 8);
+    while ((n = spill_pop_many(squeue, values, 8)) > 0) {
+        for (size_t i = 0; i < n; i++) {
+            struct message* msg = values[i];
+            char text[sizeof(msg->text)];
+
+            snprintf(text, sizeof(text), "message %zu", total);
+            assert(msg->id == total && strcmp(msg->text, text) == 0);
+            free(msg);
+            total++;
+        }
+    }
+    assert(total == 10);
+    destroy_spill_queue(squeue);
+    destroy_queue(queue);
+}
+
+struct consumer_args {
+    SPMCSpillQueue* squeue;
+    _Atomic uint8_t* ledger;
+    _Atomic bool* done;
+    unsigned int seed;
+    uint64_t count;
+};
+
+static void*
+consumer_thread(void* arg)
+{
+    struct consumer_args* ca = arg;
+    uintptr_t last_value = 0;
+    void* values[16];
+
+    for (;;) {
+        bool done = atomic_load_explicit(ca->done, memory_order_acquire);
+        size_t n = spill_pop_many(ca->squeue, values, 1 + rand_r(&ca->seed) % 16);
+
+        if (n == 0 && done) {
+            return NULL;
+        }
+        for (size_t i = 0; i < n; i++) {
+            uintptr_t value = (uintptr_t)values[i];
+            uint8_t seen;
+
+            assert(value > last_value && value <= NITEMS);
+            seen = atomic_exchange(&ca->ledger[value - 1], 1);
+            assert(seen == 0);
+            last_value = value;
+        }
+        ca->count += n;
+        // Stall now and then so that the producer has to spill
+        if (rand_r(&ca->seed) % 4096 == 0) {
+            usleep(2000);
+        }
+    }
+}
+
+static void
+test_spill_concurrent(void)
+{
+    SPMCQueue* queue = create_queue(64);
+    SPMCSpillQueue* squeue;
+    struct consumer_args ca[NCONSUMERS];
+    pthread_t threads[NCONSUMERS];
+    _Atomic uint8_t* ledger = calloc(NITEMS, sizeof(ledger[0]));
+    _Atomic bool done;
+    uint64_t total = 0, maxpending = 0;
+
+    assert(queue != NULL && ledger != NULL);
+    squeue = create_spill_queue(queue, spill_path, 4096 * sizeof(void*), 0,
+      NULL, NULL, NULL);
+    assert(squeue != NULL);
+    atomic_init(&done, false);
+    for (int i = 0; i < NCONSUMERS; i++) {
+        ca[i] = (struct consumer_args){.squeue = squeue, .ledger = ledger,
+          .done = &done, .seed = (unsigned int)i + 1};
+        if (pthread_create(&threads[i], NULL, consumer_thread, &ca[i])) {
+            fprintf(stderr, "Error creating thread\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (uintptr_t i = 1; i <= NITEMS; i++) {
+        // Lossless as long as the spill does not fill up
+        while (!spill_push(squeue, (void*)i)) {
+            sched_yield();
+        }
+        if ((i & 255) == 0 && spill_pending(squeue) > maxpending) {
+            maxpending = spill_pending(squeue);
+        }
+    }
+    atomic_store_explicit(&done, true, memory_order_release);
+    for (int i = 0; i < NCONSUMERS; i++) {
+        if (pthread_join(threads[i], NULL)) {
+            fprintf(stderr, "Error joining thread\n");
+            exit(EXIT_FAILURE);
+        }
+        total += ca[i].count;
+    }
+    assert(total == NITEMS && spill_pending(squeue) == 0);
+    for (size_t i = 0; i < NITEMS; i++) {
+        assert(atomic_load(&ledger[i]) == 1);
+    }
+    printf("spill: %d items, up to %llu spilled at once\n", NITEMS,
+      (unsigned long long)maxpending);
+    free((void*)ledger);
+    destroy_spill_queue(squeue);
+    destroy_queue(queue);
+}
+
+int
+main(void)
+{
+    make_spill_path();
+    test_spill_order();
+    test_spill_encode();
+    test_spill_concurrent();
+    return 0;
+}
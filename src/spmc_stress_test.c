@@ -0,0 +1,303 @@
+#include <assert.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "SPMCQueue.h"
+
+/*
+ * Multi-threaded stress test for the SPMC queue.
+ *
+ * A single producer pushes a dense sequence of values using a random mix
+ * of try_push(), try_push_many() and staged push_stage() bursts; when the
+ * queue is full it behaves like the lossy Python binding and pops the
+ * oldest item itself, recording it as dropped. Several consumers pop with a
+ * random mix of try_pop(), try_pop_many(), their _seq variants and
+ * pop_adaptive() with random batch sizes, inserting random spins and yields
+ * to perturb the schedule. At the end of every round each value must have
+ * been either delivered to exactly one consumer or dropped exactly once,
+ * and every consumer must have observed its values in increasing order.
+ */
+
+#define DEF_ROUNDS 64
+#define DEF_ITEMS 20000
+#define DEF_CONSUMERS 3
+#define MAX_CONSUMERS 16
+#define MAX_BATCH 16
+
+/* Marks in the per-value ledger */
+#define SEEN_DELIVERED 1
+#define SEEN_DROPPED 2
+
+struct stress_round {
+    SPMCQueue* queue;
+    size_t capacity;
+    uint64_t nitems;
+    _Atomic uint8_t *ledger;
+    _Atomic uint64_t dups;
+    _Atomic bool done;
+};
+
+struct consumer_args {
+    struct stress_round* round;
+    uint64_t seed;
+    uint64_t count;
+};
+
+static uint64_t
+xorshift64(uint64_t *state)
+{
+    uint64_t x = *state;
+
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    *state = x;
+    return x;
+}
+
+static void
+random_delay(uint64_t *rng)
+{
+    uint64_t r = xorshift64(rng);
+
+    switch (r & 15) {
+    case 0:
+        sched_yield();
+        break;
+    case 1:
+    case 2:
+        for (volatile unsigned i = 0; i < (unsigned)((r >> 8) & 255); i++)
+            continue;
+        break;
+    default:
+        break;
+    }
+}
+
+static void
+ledger_mark(struct stress_round* round, uintptr_t value, uint8_t how)
+{
+    assert(value >= 1 && value <= round->nitems);
+    if (atomic_exchange_explicit(&round->ledger[value - 1], how,
+      memory_order_relaxed) != 0) {
+        atomic_fetch_add_explicit(&round->dups, 1, memory_order_relaxed);
+    }
+}
+
+static void*
+consumer_thread(void* arg)
+{
+    struct consumer_args* args = arg;
+    struct stress_round* round = args->round;
+    void* values[MAX_BATCH];
+    uintptr_t last_value = 0;
+    uint64_t rng = args->seed;
+    consumer_ctx ctx;
+
+    consumer_ctx_init(&ctx, round->queue);
+    for (;;) {
+        bool done = atomic_load_explicit(&round->done, memory_order_acquire);
+        size_t batch = 1 + (size_t)(xorshift64(&rng) % MAX_BATCH);
+        uint64_t seq = UINT64_MAX;
+        size_t n;
+
+        switch (xorshift64(&rng) % 5) {
+        case 0:
+            n = try_pop(round->queue, &values[0]) ? 1 : 0;
+            break;
+        case 1:
+            n = try_pop_many(round->queue, values, batch);
+            break;
+        case 2:
+            n = try_pop_seq(round->queue, &values[0], &seq) ? 1 : 0;
+            break;
+        case 3:
+            n = try_pop_many_seq(round->queue, values, batch, &seq);
+            break;
+        default:
+            n = pop_adaptive(&ctx, values, batch);
+            break;
+        }
+        if (n == 0 && done) {
+            consumer_ctx_fini(&ctx);
+            return NULL;
+        }
+        for (size_t i = 0; i < n; i++) {
+            uintptr_t value = (uintptr_t)values[i];
+
+            /* Values are pushed densely from 1, so value == seq + 1 */
+            if (seq != UINT64_MAX && value != seq + i + 1) {
+                fprintf(stderr, "Error: value %" PRIuPTR " at sequence %"
+                  PRIu64 "\n", value, seq + i);
+                abort();
+            }
+            if (value <= last_value) {
+                fprintf(stderr, "Error: value %" PRIuPTR " after %" PRIuPTR
+                  "\n", value, last_value);
+                abort();
+            }
+            last_value = value;
+            ledger_mark(round, value, SEEN_DELIVERED);
+            args->count += 1;
+        }
+        random_delay(&rng);
+    }
+}
+
+static uint64_t
+drop_oldest(struct stress_round* round)
+{
+    void* junk;
+
+    if (!try_pop(round->queue, &junk)) {
+        return 0;
+    }
+    ledger_mark(round, (uintptr_t)junk, SEEN_DROPPED);
+    return 1;
+}
+
+static void
+run_round(size_t capacity, unsigned int flags, uint64_t nitems,
+  int nconsumers, uint64_t seed)
+{
+    struct stress_round round = {.capacity = capacity, .nitems = nitems};
+    struct consumer_args cargs[MAX_CONSUMERS];
+    pthread_t workers[MAX_CONSUMERS];
+    void* batch[MAX_BATCH];
+    uint64_t rng = seed;
+    uint64_t next = 1, dropped = 0, delivered = 0;
+
+    round.queue = create_queue_ex(capacity, flags);
+    round.ledger = calloc(nitems, sizeof(round.ledger[0]));
+    assert(round.queue != NULL && round.ledger != NULL);
+    set_push_stage_limit(round.queue, 1 + (size_t)(xorshift64(&rng) % 8));
+    atomic_init(&round.dups, 0);
+    atomic_init(&round.done, false);
+
+    for (int i = 0; i < nconsumers; i++) {
+        cargs[i] = (struct consumer_args){.round = &round,
+          .seed = seed ^ (0x9E3779B97F4A7C15ULL * (uint64_t)(i + 1))};
+        if (pthread_create(&workers[i], NULL, consumer_thread, &cargs[i])) {
+            fprintf(stderr, "Error creating thread\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    while (next <= nitems) {
+        size_t want = 1 + (size_t)(xorshift64(&rng) % MAX_BATCH);
+        size_t pushed;
+
+        if (want > nitems - next + 1) {
+            want = (size_t)(nitems - next + 1);
+        }
+        if (want == 1) {
+            pushed = try_push(round.queue, (void*)(uintptr_t)next) ? 1 : 0;
+        } else if (want <= 3) {
+            // Staged burst, published by the stage limit or push_flush()
+            for (pushed = 0; pushed < want; pushed++) {
+                if (!push_stage(round.queue, (void*)(uintptr_t)(next + pushed)))
+                    break;
+            }
+            if (xorshift64(&rng) & 1) {
+                push_flush(round.queue);
+            }
+        } else {
+            for (size_t i = 0; i < want; i++) {
+                batch[i] = (void*)(uintptr_t)(next + i);
+            }
+            pushed = try_push_many(round.queue, batch, want);
+        }
+        next += pushed;
+        if (pushed == 0) {
+            dropped += drop_oldest(&round);
+        }
+        random_delay(&rng);
+    }
+
+    push_flush(round.queue);
+    atomic_store_explicit(&round.done, true, memory_order_release);
+    for (int i = 0; i < nconsumers; i++) {
+        if (pthread_join(workers[i], NULL)) {
+            fprintf(stderr, "Error joining thread\n");
+            exit(EXIT_FAILURE);
+        }
+        delivered += cargs[i].count;
+    }
+
+    for (uint64_t i = 0; i < nitems; i++) {
+        uint8_t how = atomic_load_explicit(&round.ledger[i],
+          memory_order_relaxed);
+
+        if (how != SEEN_DELIVERED && how != SEEN_DROPPED) {
+            fprintf(stderr, "Error: value %" PRIu64 " was lost "
+              "(capacity %zu, seed %" PRIu64 ")\n", i + 1, capacity, seed);
+            abort();
+        }
+    }
+    if (atomic_load(&round.dups) != 0 || delivered + dropped != nitems) {
+        fprintf(stderr, "Error: %" PRIu64 " duplicate deliveries, %" PRIu64
+          " delivered + %" PRIu64 " dropped != %" PRIu64 " (capacity %zu, "
+          "seed %" PRIu64 ")\n", (uint64_t)atomic_load(&round.dups), delivered,
+          dropped, nitems, capacity, seed);
+        abort();
+    }
+
+    free((void*)round.ledger);
+    destroy_queue(round.queue);
+}
+
+int
+main(int argc, char *argv[])
+{
+    int rounds = DEF_ROUNDS;
+    uint64_t nitems = DEF_ITEMS;
+    int nconsumers = DEF_CONSUMERS;
+    uint64_t seed = 0x5EED5EED5EED5EEDULL;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "r:n:c:s:")) != -1) {
+        switch (opt) {
+        case 'r':
+            rounds = atoi(optarg);
+            break;
+        case 'n':
+            nitems = strtoull(optarg, NULL, 0);
+            break;
+        case 'c':
+            nconsumers = atoi(optarg);
+            break;
+        case 's':
+            seed = strtoull(optarg, NULL, 0);
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-r rounds] [-n items] [-c consumers] "
+              "[-s seed]\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (rounds <= 0 || nitems == 0 || nconsumers <= 0 ||
+      nconsumers > MAX_CONSUMERS || seed == 0) {
+        fprintf(stderr, "Invalid arguments\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (int r = 0; r < rounds; r++) {
+        /* Cycle through small capacities to exercise wrap-around */
+        size_t capacity = (size_t)1 << (1 + r % 8);
+        unsigned int flags = (r / 8) % 2 ? SPMC_SLOTS_SWIZZLED : 0;
+        uint64_t rseed = seed + 0x9E3779B97F4A7C15ULL * (uint64_t)r;
+
+        run_round(capacity, flags, nitems, nconsumers, rseed);
+    }
+    printf("%d rounds x %" PRIu64 " items with %d consumers: OK\n", rounds,
+      nitems, nconsumers);
+    return 0;
+}
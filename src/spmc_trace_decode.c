@@ -0,0 +1,257 @@
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "SPMCTrace.h"
+
+/*
+ * Decoder for the SPMC_TRACE per-thread event rings.
+ *
+ * Reads one or more spmc-trace.<pid>.<tid>.bin files and prints, per
+ * operation type, the call count, empty/full results, latency percentiles
+ * and contention statistics (readIdx CAS retries, cached index refreshes).
+ * With -t it also prints a timeline of every record, merged across threads
+ * and ordered by start time, for correlating slow operations; -s limits
+ * the timeline to operations slower than the given number of ns.
+ */
+
+static const char *op_names[SPMC_TOP_MAX] = {
+    [SPMC_TOP_PUSH] = "try_push",
+    [SPMC_TOP_PUSH_MANY] = "try_push_many",
+    [SPMC_TOP_PUSH_MANY_PRE] = "try_push_many_pre",
+    [SPMC_TOP_PUSH_MANY_KV] = "try_push_many_kv",
+    [SPMC_TOP_POP] = "try_pop",
+    [SPMC_TOP_POP_MANY] = "try_pop_many",
+    [SPMC_TOP_PUSH_STAGE] = "push_stage",
+    [SPMC_TOP_PUSH_FLUSH] = "push_flush",
+    [SPMC_TOP_POP_ADAPTIVE] = "pop_adaptive",
+};
+
+struct event {
+    double start_ns;
+    double dur_ns;
+    uint64_t tid;
+    const struct spmc_trace_rec *rec;
+};
+
+struct trace_file {
+    const char *path;
+    const struct spmc_trace_hdr *hdr;
+    const struct spmc_trace_rec *recs;
+    uint64_t first, count;
+};
+
+static int
+load_file(const char *path, struct trace_file *tf)
+{
+    struct stat st;
+    void *map;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        perror(path);
+        return -1;
+    }
+    if ((size_t)st.st_size < sizeof(struct spmc_trace_hdr)) {
+        fprintf(stderr, "%s: too short\n", path);
+        close(fd);
+        return -1;
+    }
+    map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror(path);
+        return -1;
+    }
+    tf->path = path;
+    tf->hdr = map;
+    if (tf->hdr->magic != SPMC_TRACE_MAGIC ||
+      tf->hdr->version != SPMC_TRACE_VERSION ||
+      tf->hdr->record_size != sizeof(struct spmc_trace_rec) ||
+      (size_t)st.st_size < sizeof(struct spmc_trace_hdr) +
+      tf->hdr->nrecords * sizeof(struct spmc_trace_rec)) {
+        fprintf(stderr, "%s: not an SPMC trace or unsupported version\n",
+          path);
+        return -1;
+    }
+    tf->recs = (const struct spmc_trace_rec *)(tf->hdr + 1);
+    tf->count = tf->hdr->nwritten;
+    tf->first = 0;
+    if (tf->count > tf->hdr->nrecords) {
+        // Ring has wrapped, only the newest nrecords survive
+        tf->first = tf->count - tf->hdr->nrecords;
+        tf->count = tf->hdr->nrecords;
+    }
+    return 0;
+}
+
+static int
+cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+static int
+cmp_event(const void *a, const void *b)
+{
+    const struct event *x = a, *y = b;
+
+    return (x->start_ns > y->start_ns) - (x->start_ns < y->start_ns);
+}
+
+static double
+percentile(const double *sorted, size_t n, double p)
+{
+    size_t i = (size_t)(p * (double)(n - 1) + 0.5);
+
+    return sorted[i];
+}
+
+static void
+print_summary(const struct event *ev, size_t nev)
+{
+    double *lat = malloc(nev * sizeof(*lat));
+
+    if (lat == NULL && nev > 0) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    printf("%-18s %10s %8s %9s %9s %9s %9s %8s %8s %8s\n", "op", "calls",
+      "none%", "p50ns", "p99ns", "p99.9ns", "maxns", "retry%", "maxretr",
+      "refresh%");
+    for (int op = 1; op < SPMC_TOP_MAX; op++) {
+        uint64_t calls = 0, none = 0, retried = 0, refresh = 0, maxretr = 0;
+        size_t n = 0;
+
+        for (size_t i = 0; i < nev; i++) {
+            const struct spmc_trace_rec *r = ev[i].rec;
+
+            if (r->op != op)
+                continue;
+            calls += 1;
+            none += (r->flags & SPMC_TF_NONE) != 0;
+            refresh += (r->flags & SPMC_TF_REFRESH) != 0;
+            retried += r->retries != 0;
+            if (r->retries > maxretr)
+                maxretr = r->retries;
+            lat[n++] = ev[i].dur_ns;
+        }
+        if (calls == 0)
+            continue;
+        qsort(lat, n, sizeof(lat[0]), cmp_double);
+        printf("%-18s %10" PRIu64 " %8.2f %9.1f %9.1f %9.1f %9.1f %8.3f "
+          "%8" PRIu64 " %8.2f\n", op_names[op], calls,
+          100.0 * (double)none / (double)calls, percentile(lat, n, 0.5),
+          percentile(lat, n, 0.99), percentile(lat, n, 0.999), lat[n - 1],
+          100.0 * (double)retried / (double)calls, maxretr,
+          100.0 * (double)refresh / (double)calls);
+    }
+    free(lat);
+}
+
+static void
+print_timeline(const struct event *ev, size_t nev, double min_ns)
+{
+    double t0 = (nev > 0) ? ev[0].start_ns : 0;
+
+    printf("%14s %8s %-18s %10s %20s %6s %7s %-7s %8s\n", "time_ns", "tid",
+      "op", "dur_ns", "idx", "count", "retries", "flags", "queue");
+    for (size_t i = 0; i < nev; i++) {
+        const struct spmc_trace_rec *r = ev[i].rec;
+        char flags[8];
+
+        if (ev[i].dur_ns < min_ns)
+            continue;
+        snprintf(flags, sizeof(flags), "%s%s",
+          (r->flags & SPMC_TF_REFRESH) ? "R" : "",
+          (r->flags & SPMC_TF_NONE) ? "N" : "");
+        printf("%14.0f %8" PRIu64 " %-18s %10.1f %20" PRIu64 " %6" PRIu32
+          " %7u %-7s %08" PRIx32 "\n", ev[i].start_ns - t0, ev[i].tid,
+          (r->op < SPMC_TOP_MAX && op_names[r->op]) ? op_names[r->op] : "?",
+          ev[i].dur_ns, r->idx, r->count, r->retries, flags, r->queue);
+    }
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct trace_file *files;
+    struct event *ev;
+    bool timeline = false;
+    double min_ns = 0;
+    size_t nev = 0, total = 0;
+    int nfiles, opt;
+
+    while ((opt = getopt(argc, argv, "ts:")) != -1) {
+        switch (opt) {
+        case 't':
+            timeline = true;
+            break;
+        case 's':
+            timeline = true;
+            min_ns = atof(optarg);
+            break;
+        default:
+            goto usage;
+        }
+    }
+    nfiles = argc - optind;
+    if (nfiles <= 0)
+        goto usage;
+
+    files = calloc((size_t)nfiles, sizeof(*files));
+    if (files == NULL) {
+        perror("calloc");
+        return 1;
+    }
+    for (int i = 0; i < nfiles; i++) {
+        if (load_file(argv[optind + i], &files[i]) != 0)
+            return 1;
+        total += files[i].count;
+    }
+    ev = malloc((total ? total : 1) * sizeof(*ev));
+    if (ev == NULL) {
+        perror("malloc");
+        return 1;
+    }
+    for (int i = 0; i < nfiles; i++) {
+        const struct trace_file *tf = &files[i];
+        const struct spmc_trace_hdr *h = tf->hdr;
+
+        for (uint64_t n = tf->first; n < tf->first + tf->count; n++) {
+            const struct spmc_trace_rec *r = &tf->recs[n % h->nrecords];
+
+            // Map TSC onto the shared monotonic clock so threads line up
+            ev[nev].start_ns = (double)h->ns0 +
+              ((double)r->tsc - (double)h->tsc0) / h->tsc_per_ns;
+            ev[nev].dur_ns = (double)r->duration / h->tsc_per_ns;
+            ev[nev].tid = h->tid;
+            ev[nev].rec = r;
+            nev++;
+        }
+    }
+    qsort(ev, nev, sizeof(ev[0]), cmp_event);
+
+    printf("%zu records from %d thread(s)\n", nev, nfiles);
+    print_summary(ev, nev);
+    if (timeline) {
+        printf("\n");
+        print_timeline(ev, nev, min_ns);
+    }
+    return 0;
+
+usage:
+    fprintf(stderr, "Usage: %s [-t] [-s min_ns] spmc-trace.*.bin...\n",
+      argv[0]);
+    return 1;
+}